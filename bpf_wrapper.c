@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <linux/perf_event.h>
+
+#include "bpf_wrapper.h"
+#include "perf_sysfs.h"
+#include "uncore_perf_plugin.h"
+#include "upe_bpf.skel.h"
+
+static struct upe_bpf* skel;
+static struct ring_buffer* ring;
+static bpf_record_callback record_callback;
+static uint64_t timer_interval_ns;
+
+/* timers and slot lists are set up when the first event of a cpu is added */
+struct bpf_cpu
+{
+    int timer_fd;
+    struct bpf_link* link;
+    struct upe_bpf_cpu_slots slots;
+};
+
+static struct bpf_cpu* bpf_cpus;
+static int32_t bpf_cpus_size;
+static struct event* slot_events[UPE_BPF_MAX_SLOTS];
+static int32_t slot_cpus[UPE_BPF_MAX_SLOTS]; /* cpu whose timer reads the slot */
+
+/* the plugin falls back to the sampling threads, so the reasons are not printed */
+static int __silent(enum libbpf_print_level level, const char* format, va_list args)
+{
+    return 0;
+}
+
+static int __handle_record(void* ctx, void* data, size_t size)
+{
+    const struct upe_bpf_record* record = data;
+
+    if (size < sizeof(*record) || record->slot >= UPE_BPF_MAX_SLOTS ||
+        slot_events[record->slot] == NULL)
+    {
+        return 0;
+    }
+    record_callback(slot_events[record->slot], record);
+    return 0;
+}
+
+int32_t bpf_sampling_init(uint64_t interval_ns, size_t ring_size, bpf_record_callback callback)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t size = page_size;
+
+    /* the ring buffer needs a power of two pages */
+    while (size < ring_size)
+    {
+        size <<= 1;
+    }
+
+    bpf_cpus_size = sysconf(_SC_NPROCESSORS_CONF);
+    if (bpf_cpus_size > UPE_BPF_MAX_CPUS)
+    {
+        bpf_cpus_size = UPE_BPF_MAX_CPUS;
+    }
+
+    libbpf_set_print(__silent);
+    skel = upe_bpf__open();
+    if (skel == NULL)
+    {
+        return -1;
+    }
+    bpf_map__set_max_entries(skel->maps.records, size);
+    bpf_map__set_max_entries(skel->maps.cpu_slots, bpf_cpus_size);
+    if (upe_bpf__load(skel))
+    {
+        upe_bpf__destroy(skel);
+        skel = NULL;
+        return -1;
+    }
+    ring = ring_buffer__new(bpf_map__fd(skel->maps.records), __handle_record, NULL, NULL);
+    if (ring == NULL)
+    {
+        upe_bpf__destroy(skel);
+        skel = NULL;
+        return -1;
+    }
+
+    bpf_cpus = calloc(bpf_cpus_size, sizeof(struct bpf_cpu));
+    if (bpf_cpus == NULL)
+    {
+        bpf_sampling_fini();
+        return -1;
+    }
+    for (int i = 0; i < bpf_cpus_size; i++)
+    {
+        bpf_cpus[i].timer_fd = -1;
+    }
+    memset(slot_events, 0, sizeof(slot_events));
+    record_callback = callback;
+    timer_interval_ns = interval_ns;
+    return 0;
+}
+
+/* sums up the per cpu counts of lost readings, they are only reported once at the end */
+static void __report_errors(void)
+{
+    __u32 key = 0;
+    int cpus = libbpf_num_possible_cpus();
+    struct upe_bpf_errors total = { 0 };
+    struct upe_bpf_errors* values;
+
+    if (cpus <= 0 || (values = calloc(cpus, sizeof(struct upe_bpf_errors))) == NULL)
+    {
+        return;
+    }
+    if (bpf_map__lookup_elem(skel->maps.errors, &key, sizeof(key), values,
+                             cpus * sizeof(struct upe_bpf_errors), 0) == 0)
+    {
+        for (int i = 0; i < cpus; i++)
+        {
+            total.read_failures += values[i].read_failures;
+            total.ring_drops += values[i].ring_drops;
+        }
+    }
+    free(values);
+    if (total.read_failures > 0)
+    {
+        fprintf(stderr, "BPF sampling: %" PRIu64 " counter reads failed\n",
+                (uint64_t)total.read_failures);
+    }
+    if (total.ring_drops > 0)
+    {
+        fprintf(stderr,
+                "BPF sampling: %" PRIu64 " readings were dropped because the ring buffer was "
+                "full, increase UPE_BUF_SIZE\n",
+                (uint64_t)total.ring_drops);
+    }
+}
+
+void bpf_sampling_fini(void)
+{
+    if (skel != NULL && bpf_cpus != NULL)
+    {
+        __report_errors();
+    }
+    for (int i = 0; i < bpf_cpus_size && bpf_cpus != NULL; i++)
+    {
+        bpf_link__destroy(bpf_cpus[i].link);
+        if (bpf_cpus[i].timer_fd >= 0)
+        {
+            close(bpf_cpus[i].timer_fd);
+        }
+    }
+    free(bpf_cpus);
+    bpf_cpus = NULL;
+    bpf_cpus_size = 0;
+    ring_buffer__free(ring);
+    ring = NULL;
+    upe_bpf__destroy(skel);
+    skel = NULL;
+}
+
+/* the program runs on each tick of a cpu clock event, which also ticks while the cpu is idle */
+static int32_t __start_timer(int32_t cpu)
+{
+    struct perf_event_attr attr = { 0 };
+    struct bpf_cpu* bcpu = &(bpf_cpus[cpu]);
+
+    if (bcpu->timer_fd >= 0)
+    {
+        return 0;
+    }
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_SW_CPU_CLOCK;
+    attr.sample_period = timer_interval_ns;
+    bcpu->timer_fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+    if (bcpu->timer_fd < 0)
+    {
+        fprintf(stderr, "Could not open the sampling timer on cpu %d: %s\n", cpu,
+                strerror(errno));
+        return -1;
+    }
+    bcpu->link = bpf_program__attach_perf_event(skel->progs.upe_sample, bcpu->timer_fd);
+    if (bcpu->link == NULL)
+    {
+        fprintf(stderr, "Could not attach the sampling program on cpu %d: %s\n", cpu,
+                strerror(errno));
+        close(bcpu->timer_fd);
+        bcpu->timer_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int32_t __update_slots(int32_t cpu)
+{
+    __u32 key = cpu;
+    return bpf_map__update_elem(skel->maps.cpu_slots, &key, sizeof(key),
+                                &(bpf_cpus[cpu].slots), sizeof(bpf_cpus[cpu].slots), BPF_ANY);
+}
+
+/* A counter can only be read by BPF on the cpu it counts on, which is not evt->cpu for uncore
+ * events, the kernel moves them to the cpu in the cpumask of their pmu. So the counter is read by
+ * the timer of that cpu. */
+int32_t bpf_sampling_add(struct event* evt)
+{
+    struct bpf_cpu* bcpu;
+    __u32 slot = 0;
+    __u32 fd = evt->fd;
+    int32_t cpu = evt->cpu < 0 ? evt->cpu : perf_pmu_cpu(evt->attr.type, evt->cpu);
+
+    if (cpu < 0 || cpu >= bpf_cpus_size)
+    {
+        return -1;
+    }
+    bcpu = &(bpf_cpus[cpu]);
+    while (slot < UPE_BPF_MAX_SLOTS && slot_events[slot] != NULL)
+    {
+        slot++;
+    }
+    if (slot == UPE_BPF_MAX_SLOTS)
+    {
+        fprintf(stderr, "Too many events for BPF sampling, at most %d are supported\n",
+                UPE_BPF_MAX_SLOTS);
+        return -1;
+    }
+    if (bpf_map__update_elem(skel->maps.counters, &slot, sizeof(slot), &fd, sizeof(fd), BPF_ANY))
+    {
+        fprintf(stderr, "Could not add %s to the BPF program: %s\n", evt->name, strerror(errno));
+        return -1;
+    }
+    slot_events[slot] = evt;
+    slot_cpus[slot] = cpu;
+    evt->bpf_slot = slot;
+
+    bcpu->slots.slots[bcpu->slots.count++] = slot;
+    if (__update_slots(cpu) || __start_timer(cpu))
+    {
+        bpf_sampling_remove(evt);
+        return -1;
+    }
+    return 0;
+}
+
+void bpf_sampling_remove(struct event* evt)
+{
+    struct bpf_cpu* bcpu;
+    __u32 slot = evt->bpf_slot;
+
+    if (evt->bpf_slot < 0 || slot >= UPE_BPF_MAX_SLOTS || slot_events[slot] != evt)
+    {
+        return;
+    }
+    bcpu = &(bpf_cpus[slot_cpus[slot]]);
+    for (__u32 i = 0; i < bcpu->slots.count; i++)
+    {
+        if (bcpu->slots.slots[i] == slot)
+        {
+            bcpu->slots.slots[i] = bcpu->slots.slots[--bcpu->slots.count];
+            break;
+        }
+    }
+    __update_slots(slot_cpus[slot]);
+    bpf_map__delete_elem(skel->maps.counters, &slot, sizeof(slot), 0);
+    slot_events[slot] = NULL;
+    evt->bpf_slot = -1;
+}
+
+/* only system calls here, this is also called by the control signal handlers */
+void bpf_sampling_pause(int paused)
+{
+    for (int i = 0; i < bpf_cpus_size; i++)
+    {
+        if (bpf_cpus[i].timer_fd >= 0)
+        {
+            ioctl(bpf_cpus[i].timer_fd,
+                  paused ? PERF_EVENT_IOC_DISABLE : PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+int32_t bpf_sampling_drain(void)
+{
+    return ring_buffer__consume(ring) < 0 ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "upe_bpf.h"
+
+struct event;
+
+/* Sampling of perf counters by a BPF program, see upe_bpf.bpf.c. A cpu clock event on each sampler
+ * cpu triggers the program, which reads the counters of the cpu into a ring buffer. The records are
+ * handed to the callback by bpf_sampling_drain(). */
+typedef void (*bpf_record_callback)(struct event* evt, const struct upe_bpf_record* record);
+
+/* Loads the program, fails if BPF is not available or not permitted. Nothing is sampled until
+ * events are added. */
+int32_t bpf_sampling_init(uint64_t interval_ns, size_t ring_size, bpf_record_callback callback);
+void bpf_sampling_fini(void);
+
+/* adds the opened perf event evt->fd, which is read on the cpu it counts on, see perf_pmu_cpu() */
+int32_t bpf_sampling_add(struct event* evt);
+void bpf_sampling_remove(struct event* evt);
+
+/* stops or restarts the timers of all cpus */
+void bpf_sampling_pause(int paused);
+
+/* hands all records in the ring buffer to the callback */
+int32_t bpf_sampling_drain(void);
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cpuid.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "encoding_cache.h"
+
+struct cached_encoding
+{
+    char* event;
+    char* fstr;
+    char* pmu;
+    uint8_t* data;
+    size_t size;
+};
+
+static char* cache_path = NULL;
+static struct cached_encoding* entries = NULL;
+static int32_t entries_size = 0;
+static int32_t entries_capacity = 0;
+
+/* vendor, family, model and stepping as reported by CPUID */
+static int32_t __cpu_name(char* buf, size_t size)
+{
+    uint32_t eax, ebx, ecx, edx;
+    char vendor[13];
+
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+        return -1;
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = '\0';
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return -1;
+    uint32_t family = (eax >> 8u) & 0xfu;
+    uint32_t model = ((eax >> 4u) & 0xfu) | ((eax >> 12u) & 0xf0u);
+    if (family == 0xf)
+        family += (eax >> 20u) & 0xffu;
+    snprintf(buf, size, "%s-%u-%u-%u", vendor, family, model, eax & 0xfu);
+    return 0;
+}
+
+static int32_t __hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+static int32_t __add_entry(const char* event, const char* fstr, const char* pmu,
+                           const uint8_t* data, size_t size)
+{
+    if (entries_size == entries_capacity)
+    {
+        int32_t capacity = entries_capacity > 0 ? 2 * entries_capacity : 64;
+        struct cached_encoding* list = realloc(entries, capacity * sizeof(*list));
+        if (list == NULL)
+            return -1;
+        entries = list;
+        entries_capacity = capacity;
+    }
+    struct cached_encoding* entry = &(entries[entries_size]);
+    entry->event = strdup(event);
+    entry->fstr = strdup(fstr);
+    entry->pmu = strdup(pmu);
+    entry->data = malloc(size);
+    if (entry->event == NULL || entry->fstr == NULL || entry->pmu == NULL || entry->data == NULL)
+    {
+        free(entry->event);
+        free(entry->fstr);
+        free(entry->pmu);
+        free(entry->data);
+        return -1;
+    }
+    memcpy(entry->data, data, size);
+    entry->size = size;
+    entries_size++;
+    return 0;
+}
+
+/* parses "<event>\t<fstr>\t<pmu>\t<hex>", broken lines of an interrupted write are skipped */
+static void __parse_line(char* line)
+{
+    char* fields[4];
+    uint8_t data[1024];
+    size_t size = 0;
+
+    line[strcspn(line, "\n")] = '\0';
+    fields[0] = line;
+    for (int i = 1; i < 4; i++)
+    {
+        fields[i] = strchr(fields[i - 1], '\t');
+        if (fields[i] == NULL)
+            return;
+        *(fields[i]++) = '\0';
+    }
+    for (const char* c = fields[3]; c[0] != '\0'; c += 2)
+    {
+        int32_t high = __hex_value(c[0]);
+        int32_t low = __hex_value(c[1]);
+        if (high < 0 || low < 0 || size == sizeof(data))
+            return;
+        data[size++] = (high << 4) | low;
+    }
+    if (size == 0)
+        return;
+    __add_entry(fields[0], fields[1], strcmp(fields[2], "-") ? fields[2] : "", data, size);
+}
+
+int32_t encoding_cache_init(const char* backend, int32_t pfm_version)
+{
+    char dir[PATH_MAX];
+    char cpu[64];
+    char* env_string = getenv("UPE_ENCODING_CACHE");
+
+    encoding_cache_fini();
+    if (env_string != NULL)
+    {
+        if (env_string[0] == '\0')
+            return -1;
+        snprintf(dir, sizeof(dir), "%s", env_string);
+    }
+    else if ((env_string = getenv("XDG_CACHE_HOME")) != NULL && env_string[0] != '\0')
+    {
+        snprintf(dir, sizeof(dir), "%s/upe", env_string);
+    }
+    else if ((env_string = getenv("HOME")) != NULL && env_string[0] != '\0')
+    {
+        snprintf(dir, sizeof(dir), "%s/.cache", env_string);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof(dir), "%s/.cache/upe", env_string);
+    }
+    else
+    {
+        return -1;
+    }
+    if (mkdir(dir, 0755) && errno != EEXIST)
+    {
+        return -1;
+    }
+    if (__cpu_name(cpu, sizeof(cpu)))
+    {
+        return -1;
+    }
+
+    if (asprintf(&cache_path, "%s/%s-pfm%d.%d-%s", dir, cpu, (pfm_version >> 16) & 0xffff,
+                 pfm_version & 0xffff, backend) < 0)
+    {
+        cache_path = NULL;
+        return -1;
+    }
+
+    FILE* f = fopen(cache_path, "r");
+    if (f != NULL)
+    {
+        char* line = NULL;
+        size_t line_size = 0;
+        while (getline(&line, &line_size, f) > 0)
+        {
+            __parse_line(line);
+        }
+        free(line);
+        fclose(f);
+    }
+    return 0;
+}
+
+void encoding_cache_fini(void)
+{
+    for (int32_t i = 0; i < entries_size; i++)
+    {
+        free(entries[i].event);
+        free(entries[i].fstr);
+        free(entries[i].pmu);
+        free(entries[i].data);
+    }
+    free(entries);
+    entries = NULL;
+    entries_size = 0;
+    entries_capacity = 0;
+    free(cache_path);
+    cache_path = NULL;
+}
+
+int32_t encoding_cache_lookup(const char* event, char** fstr, char* pmu, size_t pmu_size,
+                              void* data, size_t* size)
+{
+    /* later lines replace outdated ones */
+    for (int32_t i = entries_size - 1; i >= 0; i--)
+    {
+        if (strcmp(entries[i].event, event))
+            continue;
+        if (entries[i].size > *size)
+            return -1;
+        *fstr = strdup(entries[i].fstr);
+        if (*fstr == NULL)
+            return -1;
+        snprintf(pmu, pmu_size, "%s", entries[i].pmu);
+        memcpy(data, entries[i].data, entries[i].size);
+        *size = entries[i].size;
+        return 0;
+    }
+    return -1;
+}
+
+void encoding_cache_store(const char* event, const char* fstr, const char* pmu, const void* data,
+                          size_t size)
+{
+    const uint8_t* bytes = data;
+    size_t length = strlen(event) + strlen(fstr) + strlen(pmu) + 2 * size + 8;
+
+    if (cache_path == NULL || strpbrk(event, "\t\n") != NULL || strpbrk(fstr, "\t\n") != NULL ||
+        __add_entry(event, fstr, pmu, data, size))
+    {
+        return;
+    }
+
+    char* line = malloc(length);
+    if (line == NULL)
+    {
+        return;
+    }
+    size_t pos = snprintf(line, length, "%s\t%s\t%s\t", event, fstr, pmu[0] != '\0' ? pmu : "-");
+    for (size_t i = 0; i < size; i++)
+    {
+        pos += snprintf(line + pos, length - pos, "%02x", bytes[i]);
+    }
+    line[pos++] = '\n';
+
+    /* a single write appends the whole line, even if other processes write at the same time */
+    int fd = open(cache_path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd >= 0)
+    {
+        if (write(fd, line, pos) != (ssize_t)pos)
+        {
+            fprintf(stderr, "Failed to write the encoding of %s to %s\n", event, cache_path);
+        }
+        close(fd);
+    }
+    free(line);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Event encodings of earlier runs, so the libpfm tables are only initialized for new events.
+ *
+ * The cache is a text file in the directory given by UPE_ENCODING_CACHE, named after the cpu
+ * model, the libpfm version and the backend. Each line holds the event string, the libpfm name
+ * of the event, the perf pmu the encoding belongs to ("-" for raw uncore box codes) and the
+ * encoding in hex. New lines are appended with a single write, so concurrent jobs can share a
+ * directory.
+ */
+
+/* loads the cache of the running cpu, returns -1 if caching is disabled or not possible */
+int32_t encoding_cache_init(const char* backend, int32_t pfm_version);
+void encoding_cache_fini(void);
+
+/* Copies the cached encoding of event to data, *size is the capacity of data and becomes the
+ * size of the encoding. fstr is allocated, pmu has a capacity of pmu_size. Returns -1 if the
+ * event is not cached or does not fit. */
+int32_t encoding_cache_lookup(const char* event, char** fstr, char* pmu, size_t pmu_size,
+                              void* data, size_t* size);
+void encoding_cache_store(const char* event, const char* fstr, const char* pmu, const void* data,
+                          size_t size);
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mmio_wrapper.h"
+
+#define PCI_DEVICES "/sys/bus/pci/devices/"
+
+/* numa node of the pci device the resource belongs to, 0 for other files */
+static int32_t __mmio_node(const char* path)
+{
+    char node_path[PATH_MAX];
+    char* dir = strdup(path);
+    int32_t node = 0;
+
+    snprintf(node_path, sizeof(node_path), "%s/numa_node", dirname(dir));
+    free(dir);
+
+    FILE* f = fopen(node_path, "r");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    if (fscanf(f, "%d", &node) != 1 || node < 0)
+    {
+        node = 0;
+    }
+    fclose(f);
+    return node;
+}
+
+int32_t mmio_open(const char* spec, struct mmio_counter* ctr)
+{
+    char path[PATH_MAX];
+    char* tmp;
+    uint64_t offset, page_offset;
+    long page_size = sysconf(_SC_PAGESIZE);
+    int fd;
+
+    if (strncmp(spec, MMIO_PREFIX, strlen(MMIO_PREFIX)))
+    {
+        return -1;
+    }
+    spec += strlen(MMIO_PREFIX);
+
+    /* the path may contain colons (pci addresses), so split at the last @ */
+    const char* at = strrchr(spec, '@');
+    if (at == NULL || at == spec)
+    {
+        fprintf(stderr, "Invalid mmio event %s, expected mmio:<path>@<offset>[/<width>]\n", spec);
+        return -1;
+    }
+    if (spec[0] == '/')
+        snprintf(path, sizeof(path), "%.*s", (int)(at - spec), spec);
+    else
+        snprintf(path, sizeof(path), PCI_DEVICES "%.*s", (int)(at - spec), spec);
+
+    offset = strtoull(at + 1, &tmp, 0);
+    ctr->width = 64;
+    if (*tmp == '/')
+    {
+        ctr->width = atoi(tmp + 1);
+    }
+    if (ctr->width != 32 && ctr->width != 48 && ctr->width != 64)
+    {
+        fprintf(stderr, "Unsupported counter width %d for mmio event %s\n", ctr->width, spec);
+        return -1;
+    }
+    if (offset % (ctr->width <= 32 ? 4 : 8))
+    {
+        fprintf(stderr, "Unaligned offset 0x%" PRIx64 " for mmio event %s\n", offset, spec);
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    /* map the page(s) holding the counter */
+    page_offset = offset % page_size;
+    ctr->map_size = page_offset + sizeof(uint64_t);
+    ctr->map = mmap(NULL, ctr->map_size, PROT_READ, MAP_SHARED, fd, offset - page_offset);
+    close(fd);
+    if (ctr->map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+        ctr->map = NULL;
+        return -1;
+    }
+    ctr->addr = (const volatile char*)ctr->map + page_offset;
+    ctr->node = __mmio_node(path);
+    return 0;
+}
+
+void mmio_close(struct mmio_counter* ctr)
+{
+    if (ctr->map != NULL)
+    {
+        munmap(ctr->map, ctr->map_size);
+        ctr->map = NULL;
+        ctr->addr = NULL;
+    }
+}
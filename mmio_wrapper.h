@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/* Counters read with plain loads from a mapped PCI resource or any other mappable file.
+ * Events are given as mmio:<path>@<offset>[/<width>], relative paths are taken relative to
+ * /sys/bus/pci/devices, e.g. mmio:0000:7e:00.1/resource0@0x2290/48 */
+#define MMIO_PREFIX "mmio:"
+
+struct mmio_counter
+{
+    const volatile void* addr;
+    void* map;
+    size_t map_size;
+    int32_t width;
+    int32_t node;
+};
+
+int32_t mmio_open(const char* spec, struct mmio_counter* ctr);
+void mmio_close(struct mmio_counter* ctr);
+
+static inline uint64_t mmio_read(const struct mmio_counter* ctr)
+{
+    if (ctr->width <= 32)
+    {
+        return *(const volatile uint32_t*)ctr->addr;
+    }
+    return *(const volatile uint64_t*)ctr->addr;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "msr_wrapper.h"
+#include "uncore_perf_plugin.h"
+
+/* batch interface of msr-safe (https://github.com/LLNL/msr-safe) */
+struct msr_batch_op
+{
+    uint16_t cpu;     /* cpu to execute the operation on */
+    uint16_t isrdmsr; /* 0 = wrmsr, non-zero = rdmsr */
+    int32_t err;      /* set if the operation failed */
+    uint32_t msr;     /* msr address */
+    uint64_t msrdata; /* input or result of the operation */
+    uint64_t wmask;   /* write mask applied to wrmsr */
+};
+
+struct msr_batch_array
+{
+    uint32_t numops;
+    struct msr_batch_op* ops;
+};
+
+#define X86_IOC_MSR_BATCH _IOWR('c', 0xA2, struct msr_batch_array)
+
+static int32_t initialized = 0;
+static int32_t* node_fd;
+static int32_t* node_cpu;
+static int32_t batch_fd = -1;
+/* cleared by the first sampler whose batch read fails, read by the samplers of all nodes */
+static int32_t use_batch = 0;
+
+/* first cpu listed for the node */
+static int32_t __first_cpu(int32_t node)
+{
+    char path[64];
+    int32_t cpu = -1;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    if (fscanf(f, "%d", &cpu) != 1)
+    {
+        cpu = -1;
+    }
+    fclose(f);
+    return cpu;
+}
+
+int32_t msr_wrapper_init(void)
+{
+    char path[64];
+    if (initialized)
+    {
+        return 0;
+    }
+
+    node_fd = malloc(node_num * sizeof(int32_t));
+    node_cpu = malloc(node_num * sizeof(int32_t));
+    if (node_fd == NULL || node_cpu == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory in msr_wrapper_init\n");
+        return -1;
+    }
+
+    for (int32_t i = 0; i < node_num; i++)
+    {
+        node_cpu[i] = __first_cpu(i);
+        if (node_cpu[i] < 0)
+        {
+            fprintf(stderr, "Could not find a cpu on node %d\n", i);
+            return -1;
+        }
+        /* prefer msr-safe, which does not require root */
+        snprintf(path, sizeof(path), "/dev/cpu/%d/msr_safe", node_cpu[i]);
+        node_fd[i] = open(path, O_RDWR | O_CLOEXEC);
+        if (node_fd[i] < 0)
+        {
+            snprintf(path, sizeof(path), "/dev/cpu/%d/msr", node_cpu[i]);
+            node_fd[i] = open(path, O_RDWR | O_CLOEXEC);
+        }
+        if (node_fd[i] < 0)
+        {
+            fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    /* read all counters of a node with a single ioctl if msr-safe provides it */
+    batch_fd = open("/dev/cpu/msr_batch", O_RDWR | O_CLOEXEC);
+    __atomic_store_n(&use_batch, batch_fd >= 0, __ATOMIC_RELAXED);
+
+    initialized = 1;
+    return 0;
+}
+
+void msr_wrapper_fini(void)
+{
+    if (!initialized)
+    {
+        return;
+    }
+    for (int32_t i = 0; i < node_num; i++)
+    {
+        close(node_fd[i]);
+    }
+    if (batch_fd >= 0)
+    {
+        close(batch_fd);
+        batch_fd = -1;
+        __atomic_store_n(&use_batch, 0, __ATOMIC_RELAXED);
+    }
+    free(node_fd);
+    free(node_cpu);
+    initialized = 0;
+}
+
+int32_t msr_get_device(int32_t node)
+{
+    if (!initialized || node < 0 || node >= node_num)
+    {
+        return -1;
+    }
+    return node_fd[node];
+}
+
+int32_t msr_get_setting(int32_t fd, int32_t reg, uint64_t* data)
+{
+    if (reg <= 0)
+    {
+        return 0;
+    }
+    return pread(fd, data, sizeof(uint64_t), reg);
+}
+
+int32_t msr_set_setting(int32_t fd, int32_t reg, uint64_t data)
+{
+    if (reg <= 0)
+    {
+        return 0;
+    }
+    return pwrite(fd, &data, sizeof(uint64_t), reg);
+}
+
+/* read the given registers of a node, returns 0 on success */
+int32_t msr_read_batch(int32_t node, const int32_t* regs, int32_t size, uint64_t* data)
+{
+    if (__atomic_load_n(&use_batch, __ATOMIC_RELAXED))
+    {
+        struct msr_batch_op ops[size];
+        struct msr_batch_array batch = { .numops = size, .ops = ops };
+        memset(ops, 0, sizeof(ops));
+        for (int32_t i = 0; i < size; i++)
+        {
+            ops[i].cpu = node_cpu[node];
+            ops[i].isrdmsr = 1;
+            ops[i].msr = regs[i];
+        }
+        if (ioctl(batch_fd, X86_IOC_MSR_BATCH, &batch) == 0)
+        {
+            for (int32_t i = 0; i < size; i++)
+            {
+                if (ops[i].err)
+                {
+                    return -1;
+                }
+                data[i] = ops[i].msrdata;
+            }
+            return 0;
+        }
+        /* e.g. the registers are not in the msr-safe allowlist, do not try again */
+        if (__atomic_exchange_n(&use_batch, 0, __ATOMIC_RELAXED))
+        {
+            fprintf(stderr, "msr-safe batch read failed (%s), falling back to single reads\n",
+                    strerror(errno));
+        }
+    }
+
+    for (int32_t i = 0; i < size; i++)
+    {
+        if (msr_get_setting(node_fd[node], regs[i], &(data[i])) != sizeof(uint64_t))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perf_sysfs.h"
+
+/* reads the first line of a sysfs file without the newline */
+static int32_t __read_line(const char* path, char* buf, size_t size)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    if (fgets(buf, size, f) == NULL)
+    {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+int64_t perf_pmu_type(const char* name)
+{
+    char path[PATH_MAX];
+    char buf[32];
+
+    if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL)
+    {
+        return -1;
+    }
+    snprintf(path, sizeof(path), PERF_SYSFS_DEVICES "/%s/type", name);
+    if (__read_line(path, buf, sizeof(buf)))
+    {
+        return -1;
+    }
+    return strtoll(buf, NULL, 10);
+}
+
+int32_t perf_pmu_name(uint32_t type, char* name, size_t size)
+{
+    struct dirent* entry;
+    int32_t ret = -1;
+
+    DIR* dir = opendir(PERF_SYSFS_DEVICES);
+    if (dir == NULL)
+    {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (perf_pmu_type(entry->d_name) == type)
+        {
+            snprintf(name, size, "%s", entry->d_name);
+            ret = 0;
+            break;
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+/* the package and die of a cpu, as one number for comparison */
+static int64_t __cpu_die(int32_t cpu)
+{
+    char path[PATH_MAX];
+    char buf[32];
+    int64_t die = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+             cpu);
+    if (__read_line(path, buf, sizeof(buf)))
+    {
+        return -1;
+    }
+    int64_t package = strtoll(buf, NULL, 10);
+    /* there is no die_id before Linux 5.2, one die per package is assumed then */
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/die_id", cpu);
+    if (!__read_line(path, buf, sizeof(buf)))
+    {
+        die = strtoll(buf, NULL, 10);
+    }
+    return (package << 16) | die;
+}
+
+int32_t perf_pmu_cpu(uint32_t type, int32_t cpu)
+{
+    char pmu[64];
+    char path[PATH_MAX];
+    char buf[4096];
+
+    if (perf_pmu_name(type, pmu, sizeof(pmu)))
+    {
+        return cpu;
+    }
+    snprintf(path, sizeof(path), PERF_SYSFS_DEVICES "/%s/cpumask", pmu);
+    if (__read_line(path, buf, sizeof(buf)))
+    {
+        return cpu;
+    }
+    int64_t die = __cpu_die(cpu);
+    /* the mask is a list of cpus and ranges, e.g. 0,28 or 0-3 */
+    char* save;
+    for (char* item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char* end;
+        long first = strtol(item, &end, 10);
+        long last = *end == '-' ? strtol(end + 1, NULL, 10) : first;
+        for (long c = first; c <= last; c++)
+        {
+            if (c == cpu || (die >= 0 && __cpu_die(c) == die))
+            {
+                return c;
+            }
+        }
+    }
+    return cpu;
+}
+
+int32_t perf_sysfs_is_spec(const char* spec)
+{
+    const char* slash = strchr(spec, '/');
+    return slash != NULL && slash != spec && strstr(spec, "::") == NULL;
+}
+
+/* Writes value into the bits of the attr field given by a format like "config:0-7,21". */
+static int32_t __apply_format(struct perf_event_attr* attr, const char* pmu, const char* term,
+                              uint64_t value)
+{
+    char path[PATH_MAX];
+    char format[256];
+    uint64_t* field;
+
+    snprintf(path, sizeof(path), PERF_SYSFS_DEVICES "/%s/format/%s", pmu, term);
+    if (__read_line(path, format, sizeof(format)))
+    {
+        return 1;
+    }
+
+    char* ranges = strchr(format, ':');
+    if (ranges == NULL)
+    {
+        fprintf(stderr, "Unknown format %s of %s/%s\n", format, pmu, term);
+        return -1;
+    }
+    *(ranges++) = '\0';
+    if (!strcmp(format, "config"))
+        field = (uint64_t*)&(attr->config);
+    else if (!strcmp(format, "config1"))
+        field = (uint64_t*)&(attr->config1);
+    else if (!strcmp(format, "config2"))
+        field = (uint64_t*)&(attr->config2);
+    else
+    {
+        fprintf(stderr, "Unknown format %s of %s/%s\n", format, pmu, term);
+        return -1;
+    }
+
+    /* the bits of the value are spread over the ranges, lowest bits first */
+    for (char* range = strtok(ranges, ","); range != NULL; range = strtok(NULL, ","))
+    {
+        char* end;
+        long first = strtol(range, &end, 10);
+        long last = *end == '-' ? strtol(end + 1, NULL, 10) : first;
+        if (first < 0 || last > 63 || last < first)
+        {
+            fprintf(stderr, "Unknown format range %s of %s/%s\n", range, pmu, term);
+            return -1;
+        }
+        for (long bit = first; bit <= last; bit++)
+        {
+            *field = (*field & ~(1ull << bit)) | ((value & 1u) << bit);
+            value >>= 1u;
+        }
+    }
+    if (value != 0)
+    {
+        fprintf(stderr, "Value of %s/%s does not fit into its format\n", pmu, term);
+        return -1;
+    }
+    return 0;
+}
+
+/* the scale and unit of an alias, e.g. events/cas_count_read.scale and .unit */
+static void __read_alias_metadata(struct perf_sysfs_event* evt, const char* alias)
+{
+    char path[PATH_MAX];
+    char buf[64];
+
+    snprintf(path, sizeof(path), PERF_SYSFS_DEVICES "/%s/events/%s.scale", evt->pmu, alias);
+    if (!__read_line(path, buf, sizeof(buf)))
+    {
+        double scale = strtod(buf, NULL);
+        if (scale > 0.0)
+        {
+            evt->scale = scale;
+        }
+    }
+    snprintf(path, sizeof(path), PERF_SYSFS_DEVICES "/%s/events/%s.unit", evt->pmu, alias);
+    if (__read_line(path, evt->unit, sizeof(evt->unit)))
+    {
+        evt->unit[0] = '\0';
+    }
+}
+
+/* sets the terms "name[=value],..." of an event or an alias */
+static int32_t __apply_terms(struct perf_sysfs_event* evt, const char* terms, int32_t allow_alias)
+{
+    struct perf_event_attr* attr = &(evt->attr);
+    const char* pmu = evt->pmu;
+    char path[PATH_MAX];
+    char* copy = strdup(terms);
+    char* save = NULL;
+    int32_t ret = 0;
+
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    for (char* term = strtok_r(copy, ",", &save); term != NULL && ret == 0;
+         term = strtok_r(NULL, ",", &save))
+    {
+        uint64_t value = 1;
+        char* end = NULL;
+        char* equal = strchr(term, '=');
+
+        while (isspace((unsigned char)*term))
+            term++;
+        if (*term == '\0')
+            continue;
+        if (equal != NULL)
+        {
+            *(equal++) = '\0';
+            value = strtoull(equal, &end, 0);
+            if (end == equal || (*end != '\0' && !isspace((unsigned char)*end)))
+            {
+                fprintf(stderr, "Term %s of %s needs a numeric value, not %s\n", term, pmu, equal);
+                ret = -1;
+                break;
+            }
+        }
+
+        ret = __apply_format(attr, pmu, term, value);
+        if (ret <= 0)
+            continue;
+        ret = 0;
+        if (!strcmp(term, "config"))
+            attr->config = value;
+        else if (!strcmp(term, "config1"))
+            attr->config1 = value;
+        else if (!strcmp(term, "config2"))
+            attr->config2 = value;
+        else
+        {
+            char alias[1024];
+            snprintf(path, sizeof(path), PERF_SYSFS_DEVICES "/%s/events/%s", pmu, term);
+            if (!allow_alias || equal != NULL || __read_line(path, alias, sizeof(alias)))
+            {
+                fprintf(stderr, "Unknown term %s of pmu %s\n", term, pmu);
+                ret = -1;
+            }
+            else
+            {
+                ret = __apply_terms(evt, alias, 0);
+                __read_alias_metadata(evt, term);
+            }
+        }
+    }
+    free(copy);
+    return ret;
+}
+
+static int __compare_instances(const void* a, const void* b)
+{
+    const char* x = ((const struct perf_sysfs_event*)a)->pmu;
+    const char* y = ((const struct perf_sysfs_event*)b)->pmu;
+    size_t x_len = strlen(x), y_len = strlen(y);
+    /* uncore_imc_2 before uncore_imc_10 */
+    return x_len != y_len ? (x_len > y_len) - (x_len < y_len) : strcmp(x, y);
+}
+
+/* an instance is the pmu itself or the pmu followed by a number, with or without underscore */
+static int32_t __is_instance(const char* name, const char* pmu)
+{
+    size_t len = strlen(pmu);
+
+    if (strncmp(name, pmu, len))
+        return 0;
+    name += len;
+    if (*name == '\0')
+        return 1;
+    if (*name == '_')
+        name++;
+    if (*name == '\0')
+        return 0;
+    for (; *name != '\0'; name++)
+    {
+        if (!isdigit((unsigned char)*name))
+            return 0;
+    }
+    return 1;
+}
+
+int32_t perf_sysfs_resolve(const char* spec, struct perf_sysfs_event** events)
+{
+    char pmu[64];
+    char terms[192];
+    const char* slash = strchr(spec, '/');
+    const char* end = strrchr(spec, '/');
+    struct perf_sysfs_event* list = NULL;
+    int32_t size = 0;
+    int32_t exact = 0;
+    struct dirent* entry;
+
+    if (slash == NULL || slash == end || end[1] != '\0' || (size_t)(slash - spec) >= sizeof(pmu) ||
+        (size_t)(end - slash - 1) >= sizeof(terms))
+    {
+        fprintf(stderr, "Event %s is not given as <pmu>/<terms>/\n", spec);
+        return -1;
+    }
+    memcpy(pmu, spec, slash - spec);
+    pmu[slash - spec] = '\0';
+    memcpy(terms, slash + 1, end - slash - 1);
+    terms[end - slash - 1] = '\0';
+
+    DIR* dir = opendir(PERF_SYSFS_DEVICES);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", PERF_SYSFS_DEVICES);
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL && !exact)
+    {
+        if (!__is_instance(entry->d_name, pmu) || strlen(entry->d_name) >= sizeof(list->pmu))
+        {
+            continue;
+        }
+        struct perf_sysfs_event* grown = realloc(list, (size + 1) * sizeof(*list));
+        if (grown == NULL)
+        {
+            break;
+        }
+        list = grown;
+        /* the pmu itself exists, it is not a family of instances */
+        if (!strcmp(entry->d_name, pmu))
+        {
+            exact = 1;
+            size = 0;
+        }
+        snprintf(list[size].pmu, sizeof(list[size].pmu), "%s", entry->d_name);
+        size++;
+    }
+    closedir(dir);
+    if (size == 0)
+    {
+        fprintf(stderr, "No perf pmu %s found in %s\n", pmu, PERF_SYSFS_DEVICES);
+        free(list);
+        return -1;
+    }
+    qsort(list, size, sizeof(*list), __compare_instances);
+
+    for (int32_t i = 0; i < size; i++)
+    {
+        struct perf_sysfs_event* evt = &(list[i]);
+        int64_t type = perf_pmu_type(evt->pmu);
+
+        memset(&(evt->attr), 0, sizeof(evt->attr));
+        evt->attr.type = type;
+        evt->attr.size = sizeof(evt->attr);
+        evt->scale = 1.0;
+        evt->unit[0] = '\0';
+        snprintf(evt->name, sizeof(evt->name), "%s/%s/", evt->pmu, terms);
+        if (type < 0 || __apply_terms(evt, terms, 1))
+        {
+            fprintf(stderr, "Failed to resolve %s\n", evt->name);
+            free(list);
+            return -1;
+        }
+    }
+    *events = list;
+    return size;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef NO_LIBPFM
+#include <linux/perf_event.h>
+#else
+#include <perfmon/perf_event.h>
+#endif
+
+/* Perf-style events resolved from /sys/bus/event_source/devices without libpfm, e.g.
+ * uncore_imc_0/cas_count_read/ or uncore_imc/event=0x04,umask=0x03/. A pmu name without instance
+ * number stands for all its instances (uncore_imc_0, uncore_imc_1, ...). Terms are the fields in
+ * the format directory of the pmu, config, config1 and config2, or aliases from its events
+ * directory. A term without value is set to 1. The scale and unit of an alias are kept, so the
+ * counts can be reported e.g. in MiB or Joules. */
+#define PERF_SYSFS_DEVICES "/sys/bus/event_source/devices"
+
+struct perf_sysfs_event
+{
+    char name[256]; /* the spec with the pmu replaced by the instance */
+    char pmu[64];
+    struct perf_event_attr attr;
+    double scale;  /* from the .scale file of an alias, 1.0 if there is none */
+    char unit[32]; /* from the .unit file of an alias, empty if there is none */
+};
+
+/* returns 1 if the event is given perf-style as <pmu>/<terms>/ */
+int32_t perf_sysfs_is_spec(const char* spec);
+
+/* Resolves spec for every instance of its pmu. Returns the number of instances and the allocated
+ * events in *events, or -1 on failure. */
+int32_t perf_sysfs_resolve(const char* spec, struct perf_sysfs_event** events);
+
+/* the types of pmus are assigned at boot, returns -1 if there is no such pmu */
+int64_t perf_pmu_type(const char* name);
+int32_t perf_pmu_name(uint32_t type, char* name, size_t size);
+
+/* Uncore pmus count on the cpu of their cpumask that is in the package and die of the cpu the
+ * event was opened on, the kernel moves the event there. Returns that cpu, or cpu itself for
+ * pmus without a cpumask, e.g. the core pmu and software events. */
+int32_t perf_pmu_cpu(uint32_t type, int32_t cpu);
@@ -29,49 +29,257 @@
  * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <assert.h>
+#include <cpuid.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <math.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
+#include <x86intrin.h>
 
+#ifndef NO_LIBPFM
 #include <perfmon/perf_event.h>
 #include <perfmon/pfmlib.h>
 #include <perfmon/pfmlib_perf_event.h>
+#endif
 
+#include "encoding_cache.h"
 #include "uncore_perf_plugin.h"
-#ifdef X86_ADAPT
+#ifdef UNCORE_BOXES
 #include "x86a_wrapper.h"
-#include <x86_adapt.h>
+#else
+#include "perf_sysfs.h"
 #endif
+#ifdef BPF_SAMPLING
+#include "bpf_wrapper.h"
+#endif
+
+int32_t node_num;
+int32_t cpus;
 
 static pthread_t* threads;
 static int* thread_enabled;
+static pthread_mutex_t* sampler_locks; /* held by a sampler while it reads its events */
 static int is_thread_created = 0;
 static char vt_sep = '#';
 static int ht_enabled;
-static struct event* event_list;
+static int32_t* node_cpus; /* cpus of each node in ascending order, cpus entries per node */
+static int32_t* node_cpus_size;
+/* events are allocated one by one, so pointers to them stay valid while the list grows */
+static struct event** event_list;
 static int32_t event_list_size;
+static int32_t event_list_capacity;
+/* open addressing hash of the event names (which include the package), -1 marks a free slot */
+static int32_t* event_index;
+static uint32_t event_index_size;
+
+/* the events read by one sampler */
+struct sampler_list
+{
+    struct event** events;
+    int32_t size;
+    int32_t capacity;
+};
+static struct sampler_list* sampler_lists; /* indexed by cpu, appended under sampler_locks */
 
 static uint64_t (*wtime)(void) = NULL;
+static buffer_allocator_t buffer_allocator = NULL;
+static int ring_buffers = 0;
+static int decimate_buffers = 0; /* UPE_DECIMATE, halve the resolution of full buffers */
+/* UPE_DRAIN_US, Score-P collects the samples periodically, see drain_values() */
+static uint64_t drain_us = 0;
+
+/* Streaming statistics of the rate of an event, which are recorded once per window instead of
+ * the samples. The percentile comes from a log-linear histogram with 2^HIST_SUB_BITS buckets per
+ * power of two, so its relative error is below 2^-HIST_SUB_BITS. */
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+enum summary_stat
+{
+    SUMMARY_MIN,
+    SUMMARY_AVG,
+    SUMMARY_MAX,
+    SUMMARY_STDDEV,
+    SUMMARY_P99,
+    SUMMARY_STATS
+};
+
+static const char* summary_names[SUMMARY_STATS] = { "rate min", "rate avg", "rate max",
+                                                    "rate stddev", "rate p99" };
+
+struct event_summary
+{
+    struct event* stats[SUMMARY_STATS];
+    uint64_t window_begin; /* all times in ns of CLOCK_MONOTONIC */
+    uint64_t last_ns;
+    uint64_t last_value;
+    uint64_t n;
+    double mean; /* Welford */
+    double m2;
+    double min;
+    double max;
+    uint32_t hist[HIST_BUCKETS];
+};
+
+static uint64_t summary_ns = 0;
+
+/* Share of the time of a sampler cpu its reads may take, see UPE_OVERHEAD_BUDGET. If set, each
+ * sampler chooses its own interval from the measured cost of reading its events once. */
+static double overhead_budget = 0.0;
+static uint64_t min_interval_us = 1; /* UPE_INTERVAL_US, if it is set together with the budget */
+#define CALIBRATION_ROUNDS 15
+
+/* Bounds of the interval in adaptive mode, see UPE_ADAPTIVE_US. Each sampler halves its interval
+ * when the rate of one of its events changed by more than adaptive_change since the previous
+ * sample, and stretches it again while all rates are stable. */
+static uint64_t adaptive_min_us = 0;
+static uint64_t adaptive_max_us = 0;
+static double adaptive_change = 0.1;
+/* narrow counters are read at least twice before they wrap at this rate of events per second */
+#define MAX_COUNTER_RATE 1e10
+
+/* files of the upe-record service the events are taken from, if UPE_SERVICE is set */
+static char* service_prefix = NULL;
+static struct upe_record* service_files;
+
+/* External control of the samplers, see upe_control.h. Paused samplers wait on samplers_paused
+ * with a futex, so they do not wake up until they are resumed. Between two ticks, the samplers
+ * wait on the doorbell, which upe_mark() rings for an immediate sample. */
+static uint32_t samplers_paused = 0;
+static uint32_t doorbell = 0;
+static struct event* marker_event = NULL;
+/* Marks are recorded without a lock: marker_count hands out the slots, marker_stored is the number
+ * of marks stored so far, marker_drained the number handed over by drain_values() and
+ * marker_writers the number of threads currently recording a mark. */
+static uint64_t marker_count = 0;
+static uint64_t marker_stored = 0;
+static uint64_t marker_drained = 0;
+static uint32_t marker_writers = 0;
+static char* control_fifo = NULL;
+static int control_fd = -1;
+static int control_fifo_created = 0;
+static pthread_t control_thread;
+static int control_signals = 0;
+static struct sigaction old_sigusr1, old_sigusr2;
+
+/* Flight recorder, see UPE_FLIGHT_RECORDER. The buffers are rings that keep the latest samples,
+ * until a trigger freezes them UPE_FLIGHT_POST_US later by pausing the samplers for good. */
+static int flight_recorder = 0;
+static uint64_t flight_post_ns = 0;
+static uint64_t flight_freeze_ns = 0; /* CLOCK_MONOTONIC, 0 until triggered */
+static uint32_t flight_frozen = 0;
+static char* trigger_event = NULL; /* UPE_TRIGGER, as given to get_event_info() */
+static double trigger_rate = 0.0;
+static int trigger_above = 1;
+
+/* latest values of all events and the state of the samplers, published for upe-top */
+static struct upe_live live_view;
+
+/* Invariant TSC as the clock of the samples, see UPE_TSC. The buffers then hold TSC ticks, which
+ * are mapped to wtime() by a least squares fit of calibration points when they are handed over. */
+struct tsc_point
+{
+    uint64_t tsc;
+    uint64_t wtime;
+};
+static int tsc_enabled = 0;
+static pthread_mutex_t tsc_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tsc_point* tsc_points = NULL;
+static size_t tsc_points_size = 0;
+static size_t tsc_points_capacity = 0;
+static uint64_t tsc_last_ns = 0; /* CLOCK_MONOTONIC of the newest point */
+static size_t tsc_fit_size = 0;  /* points the fit below is computed from */
+static double tsc_fit_x = 0.0;   /* mean of the ticks and of the wtime() relative to point 0 */
+static double tsc_fit_y = 0.0;
+static double tsc_fit_slope = 0.0;
+/* calibration points are taken about once per second while sampling */
+#define TSC_CALIBRATION_NS 1000000000ull
 
 #define DEFAULT_BUF_SIZE (size_t)(4 * 1024 * 1024)
 static size_t buf_size = DEFAULT_BUF_SIZE; // 4MB per Event per Thread
 static int interval_us = 100000;           // 100ms
 
+#ifdef UNCORE_BOXES
+/* per sampler statistics about the time the die counters were frozen */
+struct freeze_stats
+{
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+} __attribute__((aligned(64)));
+
+static int freeze_enabled = 0;
+static struct freeze_stats* freeze_stats;
+/* the boxes are programmed and unfrozen by the first add_counter() after init() */
+static int32_t boxes_programmed = 0;
+#else
+/* layout of read() with PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING */
+struct perf_read_format
+{
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+static int mux_quality = 0;
+#endif
+
+#ifdef BPF_SAMPLING
+/* Counters are read by a BPF program on each tick instead of the sampling threads, if UPE_BPF is
+ * set and the program can be loaded. The drain thread copies the readings from the ring buffer to
+ * the result buffers once per BPF_DRAIN_US, get_all_values() drains before it returns. */
+#define BPF_DRAIN_US 1000000
+static int bpf_enabled = 0;
+static int bpf_active = 0;
+static pthread_t bpf_thread;
+static int bpf_thread_enabled = 0;
+static pthread_mutex_t bpf_lock = PTHREAD_MUTEX_INITIALIZER;
+/* the records carry CLOCK_MONOTONIC, which is mapped linearly to the clock of the samples */
+static uint64_t bpf_mono_begin, bpf_wtime_begin, bpf_mono_end, bpf_wtime_end;
+#endif
+
 void set_pform_wtime_function(uint64_t (*pform_wtime)(void))
 {
     wtime = pform_wtime;
 }
 
+void set_buffer_allocator(buffer_allocator_t allocator)
+{
+    buffer_allocator = allocator;
+}
+
+void set_ring_buffers(int enabled)
+{
+    ring_buffers = enabled;
+}
+
+static timevalue_t* alloc_result_vector(const struct event* evt)
+{
+    if (buffer_allocator != NULL)
+    {
+        return buffer_allocator(evt, buf_size);
+    }
+    return malloc(buf_size);
+}
+
 /* PERF_FLAG_FD_CLOEXEC closes the perf event, when the file descriptor is closed */
 static inline int sys_perf_event_open(struct perf_event_attr* attr, int cpu)
 {
@@ -160,40 +368,260 @@ static int x86_energy_get_nr_packages(void)
     return nr_packages;
 }
 
-/**
- * Returns the correponding node of the give cpu.
- * If the cpu can not be found on this system -1 is returned.
- */
-static int x86_energy_node_of_cpu(int __cpu)
+static int compare_int32(const void* a, const void* b)
+{
+    return *(const int32_t*)a - *(const int32_t*)b;
+}
+
+/* Reads the cpus of each node once, so looking up the cpus of a node does not stat the nodes of
+ * every cpu again for each event. */
+static int read_topology(void)
 {
-    int nr_packages = x86_energy_get_nr_packages();
     char path[64];
 
-    for (int node = 0; node < nr_packages; node++)
+    node_cpus = calloc((size_t)node_num * cpus, sizeof(int32_t));
+    node_cpus_size = calloc(node_num, sizeof(int32_t));
+    if (node_cpus == NULL || node_cpus_size == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for the topology\n");
+        return -1;
+    }
+    for (int node = 0; node < node_num; node++)
     {
-        int sz = snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", node, __cpu);
-        assert(sz < sizeof(path));
-        struct stat stat_buf;
-        int stat_ret = stat(path, &stat_buf);
-        if (0 == stat_ret)
+        int32_t* list = &(node_cpus[(size_t)node * cpus]);
+        struct dirent* entry;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+        DIR* dir = opendir(path);
+        if (dir == NULL)
+        {
+            continue;
+        }
+        while ((entry = readdir(dir)) != NULL)
         {
-            return node;
+            char* end;
+            if (strncmp(entry->d_name, "cpu", 3) || !isdigit((unsigned char)entry->d_name[3]))
+            {
+                continue;
+            }
+            long cpu = strtol(entry->d_name + 3, &end, 10);
+            if (*end == '\0' && cpu < cpus && node_cpus_size[node] < cpus)
+            {
+                list[node_cpus_size[node]++] = cpu;
+            }
         }
+        closedir(dir);
+        qsort(list, node_cpus_size[node], sizeof(int32_t), compare_int32);
     }
-    return -1;
+    return 0;
+}
+
+#ifndef METRIC_SYNC
+static void set_paused(uint32_t paused)
+{
+#ifdef BPF_SAMPLING
+    if (bpf_active)
+    {
+        bpf_sampling_pause(paused);
+    }
+#endif
+    __atomic_store_n(&samplers_paused, paused, __ATOMIC_RELEASE);
+    if (!paused)
+    {
+        syscall(SYS_futex, &samplers_paused, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+static void wait_while_paused(void)
+{
+    while (__atomic_load_n(&samplers_paused, __ATOMIC_ACQUIRE))
+    {
+        syscall(SYS_futex, &samplers_paused, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+static void ring_doorbell(void)
+{
+    __atomic_fetch_add(&doorbell, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &doorbell, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* sleeps for us usecs, or until the doorbell rings after it was read as rung */
+static void wait_for_tick(uint32_t rung, uint64_t us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    syscall(SYS_futex, &doorbell, FUTEX_WAIT_PRIVATE, rung, &ts, NULL, 0);
+}
+
+/* only async-signal-safe calls here */
+static void handle_control_signal(int sig)
+{
+    if (!__atomic_load_n(&flight_frozen, __ATOMIC_ACQUIRE))
+    {
+        set_paused(sig == SIGUSR2);
+    }
+}
+
+static void control_command(const char* command)
+{
+    if (!strcmp(command, "start"))
+        upe_control(UPE_CONTROL_START);
+    else if (!strcmp(command, "stop"))
+        upe_control(UPE_CONTROL_STOP);
+    else if (!strcmp(command, "mark"))
+        upe_control(UPE_CONTROL_MARK);
+    else if (!strcmp(command, "trigger"))
+        upe_control(UPE_CONTROL_TRIGGER);
+    else if (command[0] != '\0')
+        fprintf(stderr, "Unknown command '%s' on %s\n", command, control_fifo);
+}
+
+/* executes the commands written to the control fifo, one per line */
+static void* control_fifo_thread(void* arg)
+{
+    char buf[256];
+    size_t len = 0;
+
+    while (1)
+    {
+        ssize_t ret = read(control_fd, buf + len, sizeof(buf) - 1 - len);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return NULL;
+        }
+        len += ret;
+
+        char* line = buf;
+        char* end;
+        while ((end = memchr(line, '\n', buf + len - line)) != NULL)
+        {
+            *end = '\0';
+            if (end > line && end[-1] == '\r')
+                end[-1] = '\0';
+            control_command(line);
+            line = end + 1;
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+        /* drop lines that do not fit into the buffer */
+        if (len == sizeof(buf) - 1)
+        {
+            len = 0;
+        }
+    }
+}
+
+static int32_t start_control(void)
+{
+    char* env_string = getenv("UPE_START_PAUSED");
+    samplers_paused = (env_string != NULL && atoi(env_string) != 0);
+
+    env_string = getenv("UPE_CONTROL_SIGNALS");
+    if (env_string != NULL && atoi(env_string) != 0)
+    {
+        struct sigaction action = { 0 };
+        action.sa_handler = handle_control_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, &old_sigusr1);
+        sigaction(SIGUSR2, &action, &old_sigusr2);
+        control_signals = 1;
+    }
+
+    env_string = getenv("UPE_CONTROL_FIFO");
+    if (env_string == NULL || env_string[0] == '\0')
+    {
+        return 0;
+    }
+    if (mkfifo(env_string, 0600) == 0)
+    {
+        control_fifo_created = 1;
+    }
+    else if (errno != EEXIST)
+    {
+        fprintf(stderr, "Could not create the control fifo %s: %s\n", env_string,
+                strerror(errno));
+        return -1;
+    }
+    /* opened for writing as well, so the fifo never reports end of file and the open does not
+     * wait for a writer */
+    control_fd = open(env_string, O_RDWR | O_CLOEXEC);
+    if (control_fd < 0)
+    {
+        fprintf(stderr, "Could not open the control fifo %s: %s\n", env_string, strerror(errno));
+        return -1;
+    }
+    control_fifo = strdup(env_string);
+    if (pthread_create(&control_thread, NULL, control_fifo_thread, NULL))
+    {
+        fprintf(stderr, "Failed to create the control thread\n");
+        close(control_fd);
+        control_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_control(void)
+{
+    if (control_fd >= 0)
+    {
+        pthread_cancel(control_thread);
+        pthread_join(control_thread, NULL);
+        close(control_fd);
+        control_fd = -1;
+        if (control_fifo_created)
+        {
+            unlink(control_fifo);
+            control_fifo_created = 0;
+        }
+        free(control_fifo);
+        control_fifo = NULL;
+    }
+    free(trigger_event);
+    trigger_event = NULL;
+    if (control_signals)
+    {
+        sigaction(SIGUSR1, &old_sigusr1, NULL);
+        sigaction(SIGUSR2, &old_sigusr2, NULL);
+        control_signals = 0;
+    }
+}
+#endif
+
+#if !defined(METRIC_SYNC) && !defined(BACKEND_RECORD)
+/* the TSC ticks at a constant rate in all P-, C- and T-states and can be read with rdtscp */
+static int tsc_is_invariant(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 27)))
+    {
+        return 0;
+    }
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    {
+        return 0;
+    }
+    return (edx >> 8) & 1;
 }
+#endif
 
 int32_t init(void)
 {
-    threads = calloc(MAX_EVENTS, sizeof(int));
-    thread_enabled = calloc(MAX_EVENTS, sizeof(int));
     is_thread_created = 0;
     vt_sep = '#';
-    event_list = calloc(MAX_EVENTS, sizeof(struct event));
+    event_list = NULL;
     event_list_size = 0;
+    event_list_capacity = 0;
+    event_index = NULL;
+    event_index_size = 0;
 
     char* env_string;
-    int ret;
 
     /* get number of packages */
     node_num = x86_energy_get_nr_packages();
@@ -223,6 +651,157 @@ int32_t init(void)
         }
     }
 
+    env_string = getenv("UPE_DECIMATE");
+    decimate_buffers = (env_string != NULL && atoi(env_string) != 0);
+
+#ifdef UNCORE_BOXES
+    env_string = getenv("UPE_X86A_FREEZE");
+    freeze_enabled = (env_string != NULL && atoi(env_string) != 0);
+#elif !defined(METRIC_SYNC)
+    env_string = getenv("UPE_MUX_QUALITY");
+    mux_quality = (env_string != NULL && atoi(env_string) != 0);
+#endif
+#ifdef BPF_SAMPLING
+    env_string = getenv("UPE_BPF");
+    bpf_enabled = (env_string != NULL && atoi(env_string) != 0);
+    bpf_active = 0;
+#endif
+
+#ifndef METRIC_SYNC
+    env_string = getenv("UPE_SUMMARY_US");
+    if (env_string != NULL)
+    {
+        summary_ns = strtoull(env_string, NULL, 10) * 1000;
+        if (summary_ns > 0 && summary_ns < interval_us * 1000ull)
+        {
+            fprintf(stderr, "UPE_SUMMARY_US is shorter than the interval, using the interval\n");
+            summary_ns = interval_us * 1000ull;
+        }
+    }
+
+    env_string = getenv("UPE_OVERHEAD_BUDGET");
+    if (env_string != NULL)
+    {
+        char* end;
+        overhead_budget = strtod(env_string, &end);
+        if (*end == '%')
+        {
+            overhead_budget /= 100.0;
+        }
+        if (overhead_budget <= 0.0 || overhead_budget >= 1.0)
+        {
+            fprintf(stderr, "Could not parse UPE_OVERHEAD_BUDGET, using UPE_INTERVAL_US\n");
+            overhead_budget = 0.0;
+        }
+        min_interval_us = getenv("UPE_INTERVAL_US") != NULL ? interval_us : 1;
+    }
+
+    env_string = getenv("UPE_ADAPTIVE_US");
+    if (env_string != NULL && env_string[0] != '\0')
+    {
+        char* end;
+        adaptive_min_us = strtoull(env_string, &end, 10);
+        adaptive_max_us = *end == ':' ? strtoull(end + 1, &end, 10) : 0;
+        if (*end != '\0' || adaptive_min_us == 0 || adaptive_max_us < adaptive_min_us)
+        {
+            fprintf(stderr, "Could not parse UPE_ADAPTIVE_US, expected <min>:<max>, using a fixed "
+                            "interval\n");
+            adaptive_min_us = 0;
+            adaptive_max_us = 0;
+        }
+        else
+        {
+            /* the overhead budget only raises the lower bound */
+            min_interval_us = adaptive_min_us;
+        }
+    }
+    env_string = getenv("UPE_ADAPTIVE_CHANGE");
+    if (env_string != NULL)
+    {
+        char* end;
+        adaptive_change = strtod(env_string, &end);
+        if (*end == '%')
+        {
+            adaptive_change /= 100.0;
+        }
+        if (adaptive_change <= 0.0)
+        {
+            fprintf(stderr, "Could not parse UPE_ADAPTIVE_CHANGE, using 10%%\n");
+            adaptive_change = 0.1;
+        }
+    }
+
+    env_string = getenv("UPE_SERVICE");
+    if (env_string != NULL && env_string[0] != '\0')
+    {
+        service_prefix = strdup(env_string);
+        service_files = calloc(node_num, sizeof(struct upe_record));
+        if (service_prefix == NULL || service_files == NULL)
+        {
+            fprintf(stderr, "Failed to allocate memory for the service files\n");
+            return -1;
+        }
+    }
+
+#ifndef BACKEND_RECORD
+    /* upe-record has ring buffers of its own, see its service mode */
+    env_string = getenv("UPE_FLIGHT_RECORDER");
+    flight_recorder = (env_string != NULL && atoi(env_string) != 0);
+    if (flight_recorder && drain_us > 0)
+    {
+        fprintf(stderr, "UPE_FLIGHT_RECORDER can not be used with UPE_DRAIN_US, ignoring it\n");
+        flight_recorder = 0;
+    }
+    ring_buffers = flight_recorder;
+    env_string = getenv("UPE_FLIGHT_POST_US");
+    if (env_string != NULL)
+    {
+        flight_post_ns = strtoull(env_string, NULL, 10) * 1000;
+    }
+    env_string = getenv("UPE_TRIGGER");
+    if (env_string != NULL && env_string[0] != '\0')
+    {
+        char* op = strrchr(env_string, '>');
+        char* below = strrchr(env_string, '<');
+        char* end = NULL;
+        if (below != NULL && (op == NULL || below > op))
+        {
+            op = below;
+        }
+        if (op != NULL && op > env_string)
+        {
+            trigger_rate = strtod(op + 1, &end);
+        }
+        if (end == NULL || end == op + 1 || *end != '\0')
+        {
+            fprintf(stderr, "Could not parse UPE_TRIGGER, expected <event>><rate> or "
+                            "<event><<rate>\n");
+        }
+        else if (!flight_recorder)
+        {
+            fprintf(stderr, "UPE_TRIGGER is only used with UPE_FLIGHT_RECORDER\n");
+        }
+        else
+        {
+            trigger_above = *op == '>';
+            trigger_event = strndup(env_string, op - env_string);
+        }
+    }
+
+    /* upe-record files are read live and carry the clock of the recorder */
+    env_string = getenv("UPE_TSC");
+    if (env_string != NULL && atoi(env_string) != 0)
+    {
+        tsc_enabled = tsc_is_invariant();
+        if (!tsc_enabled)
+        {
+            fprintf(stderr, "The TSC is not invariant, using the clock of the measurement system "
+                            "for UPE_TSC\n");
+        }
+    }
+#endif
+#endif
+
 #if defined(BACKEND_SCOREP)
     env_string = getenv("UPE_SEP");
     if (env_string != NULL)
@@ -231,7 +810,29 @@ int32_t init(void)
     }
 #endif
 
+    /* samplers are keyed by the cpu they run on */
     cpus = sysconf(_SC_NPROCESSORS_CONF);
+    threads = calloc(cpus, sizeof(pthread_t));
+    thread_enabled = calloc(cpus, sizeof(int));
+    sampler_locks = calloc(cpus, sizeof(pthread_mutex_t));
+    sampler_lists = calloc(cpus, sizeof(struct sampler_list));
+    if (threads == NULL || thread_enabled == NULL || sampler_locks == NULL ||
+        sampler_lists == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for the samplers\n");
+        return -1;
+    }
+    for (int i = 0; i < cpus; i++)
+    {
+        pthread_mutex_init(&(sampler_locks[i]), NULL);
+    }
+#ifdef UNCORE_BOXES
+    freeze_stats = calloc(cpus, sizeof(struct freeze_stats));
+#endif
+    if (read_topology())
+    {
+        return -1;
+    }
     ht_enabled = is_ht_enabled();
     if (ht_enabled == -1)
     {
@@ -239,18 +840,31 @@ int32_t init(void)
         return -1;
     }
 
-    ret = pfm_initialize();
-    if (ret != PFM_SUCCESS)
+#ifdef UNCORE_BOXES
+    encoding_cache_init("boxes", pfm_get_version());
+#elif !defined(NO_LIBPFM)
+    encoding_cache_init("perf", pfm_get_version());
+#endif
+
+#ifdef UNCORE_BOXES
+    if (x86a_wrapper_init())
     {
-        fprintf(stderr, "cannot initialize library: %s\n", pfm_strerror(ret));
+        fprintf(stderr, "cannot initialize x86 adapt wrapper\n");
         return -1;
     }
+#endif
 
-#ifdef X86_ADAPT
-    ret = x86a_wrapper_init();
-    if (ret)
+#ifndef METRIC_SYNC
+    env_string = getenv("UPE_LIVE");
+    if (env_string != NULL && env_string[0] != '\0' &&
+        upe_live_create(env_string, interval_us, &live_view) == 0)
+    {
+        live_view.header->sampler_count =
+            cpus < UPE_LIVE_MAX_SAMPLERS ? cpus : UPE_LIVE_MAX_SAMPLERS;
+    }
+
+    if (start_control())
     {
-        fprintf(stderr, "cannot initialize x86 adapt wrapper\n");
         return -1;
     }
 #endif
@@ -258,10 +872,17 @@ int32_t init(void)
     return 0;
 }
 
-static int32_t get_scatter_id(char* event_name)
+static int32_t get_scatter_id(const char* event_name)
 {
     static int32_t scatter_id = 0;
     int32_t phys_cpus; /* physical cpus per node */
+#ifdef UNCORE_BOXES
+    /* a frozen snapshot has to cover all events of a die, so use a single sampler per die */
+    if (freeze_enabled)
+    {
+        return 0;
+    }
+#endif
     if (ht_enabled)
     {
         phys_cpus = cpus / 2 / node_num;
@@ -273,7 +894,7 @@ static int32_t get_scatter_id(char* event_name)
     /* wrap around scatter id */
     scatter_id = scatter_id % phys_cpus;
     /* assign cbox event to correponding core */
-    char* unc_cbo = strstr(event_name, "unc_cbo");
+    const char* unc_cbo = strstr(event_name, "unc_cbo");
     if (unc_cbo != NULL)
     {
         return atoi(unc_cbo + strlen("unc_cbo"));
@@ -281,97 +902,202 @@ static int32_t get_scatter_id(char* event_name)
     return scatter_id++;
 }
 
-metric_properties_t* get_event_info(char* __event_name)
+/* returns the nth cpu of the given node, so the sampling overhead is distributed across multiple
+ * cpus, or -1 if the node has not that many cpus */
+static int32_t nth_cpu_of_node(int32_t node, int32_t n)
 {
-    int ret;
-    char* fstr = NULL;
-    char buf[1024];
-    char* event_name = strdup(__event_name);
-    int32_t scatter_id;
+    if (node < 0 || node >= node_num || n < 0 || n >= node_cpus_size[node])
+    {
+        return -1;
+    }
+    return node_cpus[(size_t)node * cpus + n];
+}
 
-#ifdef X86_ADAPT
-    pfm_pmu_encode_arg_t enc = { 0 };
-#else
-    pfm_perf_encode_arg_t enc = { 0 };
-    struct perf_event_attr attr = { 0 };
-    enc.attr = &attr;
-#endif
-    enc.fstr = &fstr;
+/* FNV-1a */
+static uint32_t hash_name(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++)
+    {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
 
-#ifdef BACKEND_VTRACE
-    for (int i = 0; i < strlen(event_name); i++)
-        if (event_name[i] == vt_sep)
-            event_name[i] = ':';
-#endif
+/* returns the slot of name in the index, which is free if there is no such event */
+static uint32_t find_slot(const char* name)
+{
+    uint32_t mask = event_index_size - 1;
+    uint32_t slot = hash_name(name) & mask;
 
-#ifdef X86_ADAPT
-    ret = pfm_get_os_event_encoding(event_name, PFM_PLM0 | PFM_PLM3, PFM_OS_NONE, &enc);
-#else
-    ret = pfm_get_os_event_encoding(event_name, PFM_PLM0 | PFM_PLM3, PFM_OS_PERF_EVENT, &enc);
-#endif
-    if (ret != PFM_SUCCESS)
+    while (event_index[slot] >= 0 && strcmp(event_list[event_index[slot]]->name, name))
     {
-        fprintf(stderr, "Failed to encode event: %s\n", event_name);
-        fprintf(stderr, "%s\n", pfm_strerror(ret));
-        return NULL;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* returns the id of the first event registered with name, or -1 */
+static int32_t find_event(const char* name)
+{
+    if (event_index_size == 0)
+    {
+        return -1;
     }
+    return event_index[find_slot(name)];
+}
 
-    scatter_id = get_scatter_id(event_name);
+static int grow_index(void)
+{
+    int32_t* old_index = event_index;
+    uint32_t old_size = event_index_size;
+    uint32_t size = old_size > 0 ? 2 * old_size : 1024;
 
-    for (int node = 0; node < node_num; node++)
+    event_index = malloc(size * sizeof(int32_t));
+    if (event_index == NULL)
     {
-        /* create event name */
-        event_list[event_list_size].node = node;
-        event_list[event_list_size].scatter_id = scatter_id;
-        sprintf(buf, "Package: %d Event: %s", node, fstr);
-        event_list[event_list_size].name = strdup(buf);
+        fprintf(stderr, "Failed to allocate memory for the event index\n");
+        event_index = old_index;
+        return -1;
+    }
+    memset(event_index, 0xff, size * sizeof(int32_t));
+    event_index_size = size;
+    for (uint32_t i = 0; i < old_size; i++)
+    {
+        if (old_index[i] >= 0)
+        {
+            event_index[find_slot(event_list[old_index[i]]->name)] = old_index[i];
+        }
+    }
+    free(old_index);
+    return 0;
+}
+
+static int append_event(struct sampler_list* list, struct event* evt)
+{
+    if (list->size == list->capacity)
+    {
+        int32_t capacity = list->capacity > 0 ? 2 * list->capacity : 16;
+        struct event** events = realloc(list->events, capacity * sizeof(struct event*));
+        if (events == NULL)
+        {
+            fprintf(stderr, "Failed to allocate memory for the events of cpu %d\n", evt->cpu);
+            return -1;
+        }
+        list->events = events;
+        list->capacity = capacity;
+    }
+    list->events[list->size++] = evt;
+    return 0;
+}
 
-        event_list[event_list_size].data_count = 0;
-        event_list[event_list_size].result_vector = malloc(buf_size);
-        if (event_list[event_list_size].result_vector == NULL)
+/* returns the event behind the end of the list, it becomes part of it with commit_event() */
+static struct event* next_event(void)
+{
+    if (event_list_size == event_list_capacity)
+    {
+        int32_t capacity = event_list_capacity > 0 ? 2 * event_list_capacity : 64;
+        struct event** list = realloc(event_list, capacity * sizeof(struct event*));
+        if (list == NULL)
         {
-            fprintf(stderr, "Could not allocate memory for result_vector\n");
+            fprintf(stderr, "Failed to allocate memory for the event list\n");
             return NULL;
         }
+        memset(list + event_list_capacity, 0,
+               (capacity - event_list_capacity) * sizeof(struct event*));
+        event_list = list;
+        event_list_capacity = capacity;
+    }
+    if (event_list[event_list_size] == NULL)
+    {
+        event_list[event_list_size] = malloc(sizeof(struct event));
+        if (event_list[event_list_size] == NULL)
+        {
+            fprintf(stderr, "Failed to allocate memory for an event\n");
+        }
+    }
+    return event_list[event_list_size];
+}
+
+/* adds the event returned by next_event() to the index and to the list of its sampler */
+static int commit_event(struct event* evt)
+{
+    int ret = 0;
 
-        /* we search for the nth cpu on the node to distribute the sampling overhead across multiple
-         * cpus */
-        int32_t node_cpu = 0;
-        for (int i = 0; i < cpus; i++)
+    if (2 * (uint32_t)(event_list_size + 1) > event_index_size && grow_index())
+    {
+        return -1;
+    }
+    if (evt->cpu >= 0)
+    {
+        pthread_mutex_lock(&(sampler_locks[evt->cpu]));
+        ret = append_event(&(sampler_lists[evt->cpu]), evt);
+        pthread_mutex_unlock(&(sampler_locks[evt->cpu]));
+        if (ret)
         {
-            if (x86_energy_node_of_cpu(i) == node)
-            {
-                if (node_cpu == event_list[event_list_size].scatter_id)
-                {
-                    event_list[event_list_size].cpu = i;
-#ifdef X86_ADAPT
-                    int32_t ret = x86a_setup_counter(&(event_list[event_list_size]), &enc, i);
-                    if (ret)
-                    {
-                        fprintf(stderr, "Failed to set up the counter\n");
-                        return NULL;
-                    }
-#else
-                    int fd = sys_perf_event_open(&attr, node_cpu);
-                    if (fd < 0)
-                    {
-                        fprintf(stderr, "Failed to get file descriptor\n");
-                        return NULL;
-                    }
-                    event_list[event_list_size].fd = fd;
-#endif
-                    break;
-                }
-                else
-                {
-                    node_cpu++;
-                }
-            }
+            return -1;
         }
-        event_list_size++;
     }
+    uint32_t slot = find_slot(evt->name);
+    if (event_index[slot] < 0)
+    {
+        event_index[slot] = event_list_size;
+    }
+    event_list_size++;
+    return 0;
+}
+
+#ifdef BACKEND_SCOREP
+/* whether scale is an exact power of two (e.g. 2^-14 MiB per cas_count, 2^-32 J per RAPL unit) or
+ * of ten, returns 1 and the exponent for these */
+static int scale_exponent(double scale, int32_t* binary, int64_t* exponent)
+{
+    int exp;
+
+    if (frexp(scale, &exp) == 0.5)
+    {
+        *binary = 1;
+        *exponent = exp - 1;
+        return 1;
+    }
+    double decimal = round(log10(scale));
+    if (fabs(pow(10.0, decimal) - scale) <= 1e-12 * scale)
+    {
+        *binary = 0;
+        *exponent = (int64_t)decimal;
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+/* the counts of the event are multiplied with its sysfs scale before they are returned and are
+ * reported as doubles, unless the measurement system can express the scale as an exponent.
+ * Recordings keep the raw counts, as they are read live and by other processes. */
+static int event_is_scaled(const struct event* evt)
+{
+#ifdef BACKEND_RECORD
+    (void)evt;
+    return 0;
+#else
+    if (evt->scale == 0.0)
+    {
+        return 0;
+    }
+#ifdef BACKEND_SCOREP
+    int32_t binary;
+    int64_t exponent;
+    return !scale_exponent(evt->scale, &binary, &exponent);
+#else
+    return 1;
+#endif
+#endif
+}
 
-    metric_properties_t* return_values = malloc((node_num + 1) * sizeof(metric_properties_t));
+/* returns the metric properties for the last count entries of the event list */
+static metric_properties_t* get_metric_properties(int32_t count)
+{
+    metric_properties_t* return_values = malloc((count + 1) * sizeof(metric_properties_t));
 
     if (return_values == NULL)
     {
@@ -379,101 +1105,1788 @@ metric_properties_t* get_event_info(char* __event_name)
         return NULL;
     }
 
-    for (int i = 0; i < node_num; i++)
+    for (int i = 0; i < count; i++)
     {
         /* if the description is null it should be considered the end */
-        return_values[i].name = strdup(event_list[event_list_size - node_num + i].name);
+        struct event* evt = event_list[event_list_size - count + i];
+        return_values[i].name = strdup(evt->name);
         return_values[i].unit = NULL;
+#ifndef BACKEND_RECORD
+        /* recordings keep the raw counts, see event_is_scaled() */
+        if (evt->unit != NULL)
+        {
+            return_values[i].unit = strdup(evt->unit);
+        }
+#endif
 #ifdef BACKEND_SCOREP
         return_values[i].description = NULL;
         return_values[i].mode = SCOREP_METRIC_MODE_ACCUMULATED_START;
         return_values[i].value_type = SCOREP_METRIC_VALUE_UINT64;
         return_values[i].base = SCOREP_METRIC_BASE_DECIMAL;
         return_values[i].exponent = 0;
+        int32_t binary;
+        int64_t exponent;
+        if (event_is_scaled(evt))
+        {
+            return_values[i].value_type = SCOREP_METRIC_VALUE_DOUBLE;
+        }
+        else if (evt->scale != 0.0 && scale_exponent(evt->scale, &binary, &exponent))
+        {
+            return_values[i].base = binary ? SCOREP_METRIC_BASE_BINARY : SCOREP_METRIC_BASE_DECIMAL;
+            return_values[i].exponent = exponent;
+        }
+        if (event_is_double(evt))
+        {
+            return_values[i].mode = SCOREP_METRIC_MODE_ABSOLUTE_LAST;
+            return_values[i].value_type = SCOREP_METRIC_VALUE_DOUBLE;
+        }
+        if (evt->type == EVENT_MARKER || evt->type == EVENT_INTERVAL ||
+            evt->type == EVENT_READ_COST)
+        {
+            return_values[i].mode = SCOREP_METRIC_MODE_ABSOLUTE_POINT;
+        }
+#endif
+#ifdef BACKEND_RECORD
+        return_values[i].is_double = event_is_double(evt);
 #endif
 #ifdef BACKEND_VTRACE
         return_values[i].cntr_property =
             VT_PLUGIN_CNTR_ACC | VT_PLUGIN_CNTR_UNSIGNED | VT_PLUGIN_CNTR_LAST;
+        if (event_is_scaled(evt))
+        {
+            return_values[i].cntr_property =
+                VT_PLUGIN_CNTR_ACC | VT_PLUGIN_CNTR_DOUBLE | VT_PLUGIN_CNTR_LAST;
+        }
+        if (event_is_double(evt))
+        {
+            return_values[i].cntr_property =
+                VT_PLUGIN_CNTR_ABS | VT_PLUGIN_CNTR_DOUBLE | VT_PLUGIN_CNTR_LAST;
+        }
+        if (evt->type == EVENT_MARKER || evt->type == EVENT_INTERVAL ||
+            evt->type == EVENT_READ_COST)
+        {
+            return_values[i].cntr_property =
+                VT_PLUGIN_CNTR_ABS | VT_PLUGIN_CNTR_UNSIGNED | VT_PLUGIN_CNTR_POINT;
+        }
 #endif
     }
     /* Last element empty */
-    return_values[node_num].name = NULL;
+    return_values[count].name = NULL;
 
     return return_values;
 }
 
-void fini(void)
+/* adds an event that is recorded by the sampler of counter */
+static struct event* add_companion(struct event* counter, enum event_type type,
+                                   const char* suffix)
 {
-    int was_enabled[MAX_EVENTS] = { 0 };
+    char buf[1024];
+    struct event* evt = next_event();
 
-    /* disable and join threads */
-    for (int i = 0; i < MAX_EVENTS; i++)
+    if (evt == NULL)
     {
-        was_enabled[i] = thread_enabled[i];
-        thread_enabled[i] = 0;
+        return NULL;
     }
-    free(thread_enabled);
+    memset(evt, 0, sizeof(*evt));
+    evt->type = type;
+    evt->node = counter->node;
+    evt->cpu = counter->cpu;
+    evt->scatter_id = counter->scatter_id;
+    evt->fd = -1;
+    snprintf(buf, sizeof(buf), "%s %s", counter->name, suffix);
+    evt->name = strdup(buf);
+    if (commit_event(evt))
+    {
+        return NULL;
+    }
+    return evt;
+}
+
+/* adds the derived events of counter, returns their number or -1 on failure */
+static int32_t add_companions(struct event* counter)
+{
+    int32_t count = 0;
 
-    for (int i = 0; i < MAX_EVENTS; i++)
+#ifndef UNCORE_BOXES
+    /* the running ratio of each counter is recorded by the sampler of the counter */
+    if (mux_quality && counter->type == EVENT_COUNTER)
     {
-        if (was_enabled[i])
+        counter->mux_ratio = add_companion(counter, EVENT_MUX_RATIO, "running ratio");
+        if (counter->mux_ratio == NULL)
         {
-            pthread_join(threads[i], NULL);
+            return -1;
         }
+        count++;
     }
-    free(threads);
+#endif
+    if (summary_ns > 0)
+    {
+        counter->summary = calloc(1, sizeof(struct event_summary));
+        if (counter->summary == NULL)
+        {
+            return -1;
+        }
+        for (int i = 0; i < SUMMARY_STATS; i++)
+        {
+            counter->summary->stats[i] = add_companion(counter, EVENT_SUMMARY, summary_names[i]);
+            if (counter->summary->stats[i] == NULL)
+            {
+                return -1;
+            }
+            count++;
+        }
+    }
+    return count;
+}
 
-    for (int i = 0; i < event_list_size; i++)
+/* a memory mapped counter belongs to a single package, given by the device it lives on */
+static metric_properties_t* get_mmio_event_info(char* event_name)
+{
+    char buf[1024];
+    struct event* evt = next_event();
+
+    if (evt == NULL)
     {
-        close(event_list[i].fd);
-        free(event_list[i].name);
+        return NULL;
     }
-    free(event_list);
+    memset(evt, 0, sizeof(*evt));
+    evt->type = EVENT_MMIO;
+    evt->fd = -1;
+    /* the mapping is only checked here, add_counter() maps it again */
+    if (mmio_open(event_name, &(evt->mmio)))
+    {
+        return NULL;
+    }
+    mmio_close(&(evt->mmio));
+    evt->ctr_mask = evt->mmio.width < 64 ? (1ull << evt->mmio.width) - 1 : UINT64_MAX;
 
-#ifdef X86_ADAPT
-    x86a_wrapper_fini();
+    evt->node = evt->mmio.node;
+    evt->scatter_id = get_scatter_id(event_name);
+    evt->cpu = nth_cpu_of_node(evt->node, evt->scatter_id);
+    if (evt->cpu < 0)
+    {
+        fprintf(stderr, "No cpu found on package %d for %s\n", evt->node, event_name);
+        return NULL;
+    }
+    sprintf(buf, "Package: %d Event: %s", evt->node, event_name);
+    evt->name = strdup(buf);
+    evt->fstr = strdup(event_name);
+    if (commit_event(evt))
+    {
+        return NULL;
+    }
+
+    int32_t count = add_companions(evt);
+    if (count < 0)
+    {
+        return NULL;
+    }
+    return get_metric_properties(1 + count);
+}
+
+/* the marks are not bound to a package, they are recorded by the thread calling upe_control() */
+static metric_properties_t* get_marker_event_info(void)
+{
+#ifdef METRIC_SYNC
+    fprintf(stderr, "%s is only available in asynchronous mode\n", UPE_MARKER_EVENT);
+    return NULL;
+#else
+    struct event* evt = next_event();
+
+    if (evt == NULL)
+    {
+        return NULL;
+    }
+    if (marker_event != NULL)
+    {
+        fprintf(stderr, "%s is already recorded\n", UPE_MARKER_EVENT);
+        return NULL;
+    }
+    memset(evt, 0, sizeof(*evt));
+    evt->type = EVENT_MARKER;
+    evt->cpu = -1;
+    evt->fd = -1;
+    evt->name = strdup(UPE_MARKER_EVENT);
+    if (commit_event(evt))
+    {
+        return NULL;
+    }
+    marker_event = evt;
+    return get_metric_properties(1);
+#endif
+}
+
+/* the interval and read cost are recorded by the sampler of the events without a scatter id */
+static metric_properties_t* get_calibration_event_info(void)
+{
+#ifdef METRIC_SYNC
+    fprintf(stderr, "%s is only available in asynchronous mode\n", UPE_CALIBRATION_EVENT);
+    return NULL;
+#else
+    char buf[1024];
+
+    for (int node = 0; node < node_num; node++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            struct event* evt = next_event();
+
+            if (evt == NULL)
+            {
+                return NULL;
+            }
+            memset(evt, 0, sizeof(*evt));
+            evt->type = i == 0 ? EVENT_INTERVAL : EVENT_READ_COST;
+            evt->node = node;
+            evt->cpu = nth_cpu_of_node(node, 0);
+            evt->fd = -1;
+            sprintf(buf, "Package: %d Event: %s %s", node, UPE_CALIBRATION_EVENT,
+                    i == 0 ? "interval us" : "read cost ns");
+            evt->name = strdup(buf);
+            if (commit_event(evt))
+            {
+                return NULL;
+            }
+        }
+    }
+    return get_metric_properties(2 * node_num);
+#endif
+}
+
+static const struct upe_record* get_service_file(int32_t node)
+{
+    char path[4096];
+
+    if (service_files[node].map != NULL)
+    {
+        return &(service_files[node]);
+    }
+    snprintf(path, sizeof(path), "%s.%d.upe", service_prefix, node);
+    if (upe_record_open(path, &(service_files[node])))
+    {
+        return NULL;
+    }
+    if (!(service_files[node].header->flags & UPE_RECORD_RING))
+    {
+        fprintf(stderr, "%s was not written by upe-record in service mode (-s)\n", path);
+        upe_record_close(&(service_files[node]));
+        return NULL;
+    }
+    return &(service_files[node]);
+}
+
+/* the counters are owned by the service, the event is looked up in the file of each package,
+ * returns the number of events found or -1 */
+static int32_t add_service_events(const char* fstr)
+{
+    char buf[1024];
+    int32_t count = 0;
+
+    for (int node = 0; node < node_num; node++)
+    {
+        struct event* evt = next_event();
+        const struct upe_record* file = get_service_file(node);
+        if (evt == NULL)
+        {
+            return -1;
+        }
+        if (file == NULL)
+        {
+            continue;
+        }
+        sprintf(buf, "Package: %d Event: %s", node, fstr);
+        int32_t service_event = upe_record_find(file, buf);
+        if (service_event < 0)
+        {
+            continue;
+        }
+
+        memset(evt, 0, sizeof(*evt));
+        evt->type = EVENT_SERVICE;
+        evt->node = node;
+        evt->cpu = -1;
+        evt->fd = -1;
+        evt->service = file;
+        evt->service_event = service_event;
+        evt->name = strdup(buf);
+        if (commit_event(evt))
+        {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+static metric_properties_t* get_service_event_info(const char* fstr)
+{
+    int32_t count = add_service_events(fstr);
+    if (count == 0)
+    {
+        fprintf(stderr, "Event %s is not recorded by the service %s\n", fstr, service_prefix);
+        return NULL;
+    }
+    return count > 0 ? get_metric_properties(count) : NULL;
+}
+
+#ifndef NO_LIBPFM
+/* libpfm is only initialized once an event is not found in the encoding cache */
+static int32_t init_pfm(void)
+{
+    static int32_t pfm_initialized = 0;
+
+    if (!pfm_initialized)
+    {
+        int ret = pfm_initialize();
+        if (ret != PFM_SUCCESS)
+        {
+            fprintf(stderr, "cannot initialize library: %s\n", pfm_strerror(ret));
+            return -1;
+        }
+        pfm_initialized = 1;
+    }
+    return 0;
+}
 #endif
+
+/* encodes an event with libpfm, or takes the encoding of an earlier run from the cache */
+#ifdef UNCORE_BOXES
+static int32_t encode_event(const char* event_name, pfm_pmu_encode_arg_t* enc)
+{
+    uint64_t codes[3];
+    size_t size = sizeof(codes);
+    char pmu[64];
+
+    if (!encoding_cache_lookup(event_name, enc->fstr, pmu, sizeof(pmu), codes, &size) &&
+        size % sizeof(uint64_t) == 0)
+    {
+        enc->codes = malloc(size);
+        if (enc->codes != NULL)
+        {
+            memcpy(enc->codes, codes, size);
+            enc->count = size / sizeof(uint64_t);
+            return 0;
+        }
+        free(*(enc->fstr));
+    }
+    *(enc->fstr) = NULL;
+    if (init_pfm())
+    {
+        return -1;
+    }
+
+    int ret = pfm_get_os_event_encoding(event_name, PFM_PLM0 | PFM_PLM3, PFM_OS_NONE, enc);
+    if (ret != PFM_SUCCESS)
+    {
+        fprintf(stderr, "Failed to encode event: %s\n", event_name);
+        fprintf(stderr, "%s\n", pfm_strerror(ret));
+        return -1;
+    }
+    if (enc->count > 0 && enc->count <= 3)
+    {
+        encoding_cache_store(event_name, *(enc->fstr), "", enc->codes,
+                             enc->count * sizeof(uint64_t));
+    }
+    return 0;
+}
+#elif !defined(NO_LIBPFM)
+static int32_t encode_event(const char* event_name, struct perf_event_attr* attr, char** fstr)
+{
+    pfm_perf_encode_arg_t enc = { 0 };
+    size_t size = sizeof(*attr);
+    char pmu[64];
+
+    if (!encoding_cache_lookup(event_name, fstr, pmu, sizeof(pmu), attr, &size))
+    {
+        /* the types of uncore pmus are assigned at boot and may differ from the cached one */
+        if (size == sizeof(*attr) && perf_pmu_type(pmu) == attr->type)
+        {
+            return 0;
+        }
+        free(*fstr);
+        memset(attr, 0, sizeof(*attr));
+    }
+    *fstr = NULL;
+    if (init_pfm())
+    {
+        return -1;
+    }
+
+    enc.attr = attr;
+    enc.fstr = fstr;
+    int ret = pfm_get_os_event_encoding(event_name, PFM_PLM0 | PFM_PLM3, PFM_OS_PERF_EVENT, &enc);
+    if (ret != PFM_SUCCESS)
+    {
+        fprintf(stderr, "Failed to encode event: %s\n", event_name);
+        fprintf(stderr, "%s\n", pfm_strerror(ret));
+        return -1;
+    }
+    if (!perf_pmu_name(attr->type, pmu, sizeof(pmu)))
+    {
+        encoding_cache_store(event_name, *fstr, pmu, attr, sizeof(*attr));
+    }
+    return 0;
+}
+#else
+static int32_t encode_event(const char* event_name, struct perf_event_attr* attr, char** fstr)
+{
+    fprintf(stderr, "Event %s can not be encoded without libpfm, give it as <pmu>/<terms>/\n",
+            event_name);
+    return -1;
+}
+#endif
+
+/* adds the events of an encoded counter on every package and their companions, returns their
+ * number or -1 */
+#ifdef UNCORE_BOXES
+static int32_t add_counter_events(const char* fstr, const pfm_pmu_encode_arg_t* enc)
+#else
+static int32_t add_counter_events(const char* fstr, const struct perf_event_attr* attr)
+#endif
+{
+    char buf[1024];
+    int32_t scatter_id = get_scatter_id(fstr);
+
+#ifdef UNCORE_BOXES
+    if (enc->count < 1 || enc->count > 3)
+    {
+        fprintf(stderr, "Unknown event encode size %d\n", enc->count);
+        return -1;
+    }
+#endif
+
+    /* only the encoding is stored, counters and buffers are set up by add_counter() */
+    for (int node = 0; node < node_num; node++)
+    {
+        struct event* evt = next_event();
+
+        if (evt == NULL)
+        {
+            return -1;
+        }
+        memset(evt, 0, sizeof(*evt));
+        evt->type = EVENT_COUNTER;
+        evt->node = node;
+        evt->scatter_id = scatter_id;
+        evt->cpu = nth_cpu_of_node(node, scatter_id);
+        evt->fd = -1;
+        snprintf(buf, sizeof(buf), "Package: %d Event: %s", node, fstr);
+        evt->name = strdup(buf);
+        evt->fstr = strdup(fstr);
+#ifdef UNCORE_BOXES
+        if (x86a_check_event(fstr, node))
+        {
+            return -1;
+        }
+        memcpy(evt->codes, enc->codes, enc->count * sizeof(uint64_t));
+        evt->codes_count = enc->count;
+#else
+        evt->attr = *attr;
+        /* the kernel multiplexes events if a pmu runs out of counters, the times allow scaling */
+        evt->attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+#endif
+        if (commit_event(evt))
+        {
+            return -1;
+        }
+    }
+
+    int32_t count = node_num;
+    int32_t first = event_list_size - node_num;
+    for (int node = 0; node < node_num; node++)
+    {
+        int32_t ret = add_companions(event_list[first + node]);
+        if (ret < 0)
+        {
+            return -1;
+        }
+        count += ret;
+    }
+    return count;
+}
+
+#ifndef UNCORE_BOXES
+/* perf-style events are resolved from sysfs, for every instance of their pmu */
+static metric_properties_t* get_sysfs_event_info(const char* spec)
+{
+    struct perf_sysfs_event* instances;
+    int32_t count = 0;
+    int32_t size = perf_sysfs_resolve(spec, &instances);
+
+    if (size < 0)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < size; i++)
+    {
+        int32_t ret = service_prefix != NULL
+                          ? add_service_events(instances[i].name)
+                          : add_counter_events(instances[i].name, &(instances[i].attr));
+        if (ret < 0)
+        {
+            free(instances);
+            return NULL;
+        }
+        /* the counters of every package come first, before their companions */
+        for (int node = 0; service_prefix == NULL && node < node_num; node++)
+        {
+            struct event* evt = event_list[event_list_size - ret + node];
+            if (instances[i].scale != 1.0)
+            {
+                evt->scale = instances[i].scale;
+            }
+            if (instances[i].unit[0] != '\0')
+            {
+                evt->unit = strdup(instances[i].unit);
+            }
+        }
+        count += ret;
+    }
+    free(instances);
+    if (count == 0)
+    {
+        fprintf(stderr, "Event %s is not recorded by the service %s\n", spec, service_prefix);
+        return NULL;
+    }
+    return get_metric_properties(count);
+}
+#endif
+
+static metric_properties_t* resolve_event_info(char* __event_name)
+{
+    char* fstr = NULL;
+    char* event_name = strdup(__event_name);
+    int32_t count;
+
+#ifdef UNCORE_BOXES
+    pfm_pmu_encode_arg_t enc = { 0 };
+    enc.fstr = &fstr;
+#else
+    struct perf_event_attr attr = { 0 };
+#endif
+
+#ifdef BACKEND_VTRACE
+    for (int i = 0; i < strlen(event_name); i++)
+        if (event_name[i] == vt_sep)
+            event_name[i] = ':';
+#endif
+
+    if (!strcmp(event_name, UPE_MARKER_EVENT))
+    {
+        return get_marker_event_info();
+    }
+    if (!strcmp(event_name, UPE_CALIBRATION_EVENT))
+    {
+        return get_calibration_event_info();
+    }
+
+    if (!strncmp(event_name, MMIO_PREFIX, strlen(MMIO_PREFIX)))
+    {
+        if (service_prefix != NULL)
+        {
+            return get_service_event_info(event_name);
+        }
+        return get_mmio_event_info(event_name);
+    }
+
+#ifdef UNCORE_BOXES
+    if (encode_event(event_name, &enc))
+    {
+        return NULL;
+    }
+#else
+    if (perf_sysfs_is_spec(event_name))
+    {
+        return get_sysfs_event_info(event_name);
+    }
+    if (encode_event(event_name, &attr, &fstr))
+    {
+        return NULL;
+    }
+#endif
+    if (service_prefix != NULL)
+    {
+        return get_service_event_info(fstr);
+    }
+
+#ifdef UNCORE_BOXES
+    count = add_counter_events(fstr, &enc);
+#else
+    count = add_counter_events(fstr, &attr);
+#endif
+    if (count < 0)
+    {
+        return NULL;
+    }
+    return get_metric_properties(count);
+}
+
+metric_properties_t* get_event_info(char* __event_name)
+{
+    int32_t first = event_list_size;
+    metric_properties_t* info = resolve_event_info(__event_name);
+
+    /* the counters of the event given by UPE_TRIGGER arm the flight recorder */
+    if (info != NULL && trigger_event != NULL && !strcmp(__event_name, trigger_event))
+    {
+        for (int i = first; i < event_list_size; i++)
+        {
+            enum event_type type = event_list[i]->type;
+            event_list[i]->trigger = type == EVENT_COUNTER || type == EVENT_MMIO;
+        }
+    }
+    return info;
+}
+
+/* closes the counter of an event, the result_vector is handed over by get_all_values() */
+static void release_event(struct event* evt)
+{
+    if (!evt->acquired)
+    {
+#ifndef UNCORE_BOXES
+        /* opened together with the counters of the other packages, but never added */
+        if (evt->type == EVENT_COUNTER && evt->fd >= 0)
+        {
+            close(evt->fd);
+            evt->fd = -1;
+        }
+#endif
+        return;
+    }
+    if (evt->live != NULL)
+    {
+        upe_live_write_begin(&(evt->live->seq));
+        evt->live->active = 0;
+        upe_live_write_end(&(evt->live->seq));
+        evt->live = NULL;
+    }
+    if (evt->type == EVENT_MMIO)
+    {
+        mmio_close(&(evt->mmio));
+    }
+    else if (evt->type == EVENT_COUNTER)
+    {
+#ifdef UNCORE_BOXES
+        x86a_release_counter(evt);
+#else
+        close(evt->fd);
+#endif
+        evt->fd = -1;
+    }
+    evt->acquired = 0;
+}
+
+#ifndef UNCORE_BOXES
+static int32_t open_perf_event(struct event* evt)
+{
+    evt->fd = sys_perf_event_open(&(evt->attr), evt->cpu);
+    if (evt->fd < 0)
+    {
+        return -1;
+    }
+    ioctl(evt->fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(evt->fd, PERF_EVENT_IOC_ENABLE, 0);
+    return 0;
+}
+
+static void* open_perf_event_thread(void* evt)
+{
+    open_perf_event(evt);
+    return NULL;
+}
+
+/* The events of all packages returned by get_event_info() are added, so the counters of all
+ * packages are opened in parallel once the first of them is added, one worker per package.
+ * Counters that failed to open are tried again and reported by acquire_event(). */
+static void open_packages(const struct event* evt)
+{
+    char buf[1024];
+    pthread_t workers[node_num];
+    struct event* packages[node_num];
+    int32_t size = 0;
+
+    for (int node = 0; node < node_num; node++)
+    {
+        snprintf(buf, sizeof(buf), "Package: %d Event: %s", node, evt->fstr);
+        int32_t id = find_event(buf);
+        if (id >= 0 && event_list[id]->type == EVENT_COUNTER && event_list[id]->fd < 0 &&
+            event_list[id]->cpu >= 0)
+        {
+            packages[size++] = event_list[id];
+        }
+    }
+    if (size < 2)
+    {
+        return;
+    }
+    for (int i = 0; i < size; i++)
+    {
+        if (pthread_create(&(workers[i]), NULL, &open_perf_event_thread, packages[i]) != 0)
+        {
+            packages[i] = NULL;
+        }
+    }
+    for (int i = 0; i < size; i++)
+    {
+        if (packages[i] != NULL)
+        {
+            pthread_join(workers[i], NULL);
+        }
+    }
+}
+#endif
+
+/* opens the counter of an event and allocates its buffer */
+static int32_t acquire_event(struct event* evt)
+{
+    if (evt->acquired)
+    {
+        return 0;
+    }
+    if (evt->cpu < 0 && evt->type != EVENT_MARKER)
+    {
+        fprintf(stderr, "No cpu found on package %d for %s\n", evt->node, evt->name);
+        return -1;
+    }
+
+    if (evt->type == EVENT_MMIO)
+    {
+        if (mmio_open(evt->fstr, &(evt->mmio)))
+        {
+            return -1;
+        }
+        evt->last = mmio_read(&(evt->mmio)) & evt->ctr_mask;
+    }
+    else if (evt->type == EVENT_COUNTER)
+    {
+#ifdef UNCORE_BOXES
+        pfm_pmu_encode_arg_t enc = { 0 };
+        enc.codes = evt->codes;
+        enc.count = evt->codes_count;
+        enc.fstr = &(evt->fstr);
+        /* other events of the box may move to another counter, which their samplers must not
+         * read meanwhile, the locks are taken in the order of the cpus */
+        for (int cpu = 0; cpu < cpus; cpu++)
+        {
+            pthread_mutex_lock(&(sampler_locks[cpu]));
+        }
+        int32_t ret = x86a_setup_counter(evt, &enc, evt->cpu);
+        for (int cpu = cpus - 1; cpu >= 0; cpu--)
+        {
+            pthread_mutex_unlock(&(sampler_locks[cpu]));
+        }
+        if (ret)
+        {
+            fprintf(stderr, "Failed to set up the counter\n");
+            return -1;
+        }
+#else
+        if (evt->fd < 0)
+        {
+            open_packages(evt);
+        }
+        if (evt->fd < 0 && open_perf_event(evt))
+        {
+            fprintf(stderr, "Failed to get file descriptor for %s: %s\n", evt->name,
+                    strerror(errno));
+            return -1;
+        }
+#endif
+    }
+
+    evt->data_count = 0;
+    evt->result_vector = alloc_result_vector(evt);
+    if (evt->result_vector == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for result_vector\n");
+        evt->acquired = 1;
+        release_event(evt);
+        return -1;
+    }
+    evt->acquired = 1;
+
+    if (live_view.map != NULL && live_view.header->event_count < UPE_LIVE_MAX_EVENTS)
+    {
+        struct upe_live_event* entry = &(live_view.events[live_view.header->event_count]);
+        upe_live_write_begin(&(entry->seq));
+        entry->package = evt->node;
+        entry->cpu = evt->cpu;
+        entry->active = 1;
+        entry->is_double = event_is_double(evt);
+        snprintf(entry->name, sizeof(entry->name), "%s", evt->name);
+        entry->capacity = ring_buffers ? 0 : buf_size / sizeof(timevalue_t);
+        upe_live_write_end(&(entry->seq));
+        __atomic_store_n(&(live_view.header->event_count), live_view.header->event_count + 1,
+                         __ATOMIC_RELEASE);
+        evt->live = entry;
+        evt->live_ns = 0;
+    }
+    return 0;
+}
+
+void fini(void)
+{
+    int was_enabled[cpus];
+
+    /* disable and join threads */
+    for (int i = 0; i < cpus; i++)
+    {
+        was_enabled[i] = thread_enabled[i];
+        thread_enabled[i] = 0;
+    }
+#ifndef METRIC_SYNC
+    stop_control();
+#ifdef BPF_SAMPLING
+    bpf_thread_enabled = 0;
+#endif
+    /* wake paused and sleeping samplers, so they see that they are disabled */
+    set_paused(0);
+    ring_doorbell();
+#endif
+#ifdef BPF_SAMPLING
+    if (bpf_active)
+    {
+        pthread_join(bpf_thread, NULL);
+        bpf_sampling_fini();
+        bpf_active = 0;
+    }
+#endif
+
+    for (int i = 0; i < cpus; i++)
+    {
+        if (was_enabled[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+        free(sampler_lists[i].events);
+    }
+    free(threads);
+    free(thread_enabled);
+    free(sampler_locks);
+    free(sampler_lists);
+
+    for (int i = 0; i < event_list_size; i++)
+    {
+        release_event(event_list[i]);
+        /* periodic calls hand over copies, the buffers stay with the plugin */
+        if (drain_us > 0)
+        {
+            free(event_list[i]->result_vector);
+        }
+        free(event_list[i]->summary);
+        free(event_list[i]->fstr);
+        free(event_list[i]->unit);
+        free(event_list[i]->name);
+    }
+    for (int i = 0; i < event_list_capacity; i++)
+    {
+        free(event_list[i]);
+    }
+    free(event_list);
+    free(event_index);
+    free(node_cpus);
+    free(node_cpus_size);
+    encoding_cache_fini();
+    event_list = NULL;
+    event_list_size = 0;
+    event_list_capacity = 0;
+    event_index = NULL;
+    event_index_size = 0;
+    upe_live_close(&live_view);
+    marker_event = NULL;
+    marker_count = 0;
+    marker_stored = 0;
+    marker_drained = 0;
+    free(tsc_points);
+    tsc_points = NULL;
+    tsc_points_size = 0;
+    tsc_points_capacity = 0;
+    tsc_last_ns = 0;
+    tsc_fit_size = 0;
+
+    if (service_prefix != NULL)
+    {
+        for (int i = 0; i < node_num; i++)
+        {
+            upe_record_close(&(service_files[i]));
+        }
+        free(service_files);
+        free(service_prefix);
+        service_prefix = NULL;
+    }
+
+#ifdef UNCORE_BOXES
+    for (int i = 0; i < cpus; i++)
+    {
+        if (freeze_stats[i].count > 0)
+        {
+            fprintf(stderr,
+                    "Freeze window on cpu %d: %" PRIu64 " snapshots, avg %.3f us, min %.3f us, "
+                    "max %.3f us\n",
+                    i, freeze_stats[i].count,
+                    freeze_stats[i].sum_ns / 1000.0 / freeze_stats[i].count,
+                    freeze_stats[i].min_ns / 1000.0, freeze_stats[i].max_ns / 1000.0);
+        }
+    }
+    free(freeze_stats);
+    x86a_wrapper_fini();
+    boxes_programmed = 0;
+#endif
+}
+
+#ifndef UNCORE_BOXES
+/* extrapolate a multiplexed count to the time the event was enabled */
+static inline uint64_t perf_scale(struct event* evt, const struct perf_read_format* raw,
+                                  double scale)
+{
+    uint64_t value = raw->value;
+    if (raw->time_enabled != raw->time_running)
+    {
+        value = raw->value * scale;
+    }
+    /* the estimate may shrink between two reads, keep the accumulated value monotonic */
+    if (value < evt->last)
+    {
+        value = evt->last;
+    }
+    evt->last = value;
+    return value;
+}
+#endif
+
+static inline uint64_t uncore_perf_read(struct event* evt)
+{
+    uint64_t data;
+    if (evt->type == EVENT_MMIO)
+    {
+        evt->last += (mmio_read(&(evt->mmio)) - evt->last) & evt->ctr_mask;
+        return evt->last;
+    }
+#ifdef UNCORE_BOXES
+    if (x86a_read_counters(&evt, 1, &data))
+    {
+        return 0;
+    }
+#else
+    struct perf_read_format raw;
+    ssize_t ret = read(evt->fd, &raw, sizeof(raw));
+    if (ret != sizeof(raw))
+    {
+        fprintf(stderr, "Error while reading event %s\n", evt->name);
+        fprintf(stderr, "%s\n", strerror(errno));
+        return 0;
+    }
+    data = perf_scale(evt, &raw,
+                      raw.time_running ? (double)raw.time_enabled / raw.time_running : 0.0);
+#endif
+    return data;
+}
+
+#ifndef METRIC_SYNC
+static inline uint64_t get_time()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_usec + tv.tv_sec * 1000000;
+}
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_nsec + ts.tv_sec * 1000000000ull;
+}
+
+/* clock of upe-record */
+static inline uint64_t get_realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_nsec + ts.tv_sec * 1000000000ull;
+}
+
+/* clock of the samples in the buffers, see UPE_TSC */
+static inline uint64_t sample_time(void)
+{
+    uint32_t aux;
+    return tsc_enabled ? __rdtscp(&aux) : wtime();
+}
+
+/* Adds a calibration point if the newest one is older than min_age_ns. wtime() is read between
+ * two rdtscp, the tightest of a few tries is kept. */
+static void tsc_checkpoint(uint64_t min_age_ns)
+{
+    uint64_t now = get_time_ns();
+    struct tsc_point point = { 0 };
+    uint64_t window = UINT64_MAX;
+    uint32_t aux;
+
+    if (now - __atomic_load_n(&tsc_last_ns, __ATOMIC_ACQUIRE) < min_age_ns)
+    {
+        return;
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        uint64_t begin = __rdtscp(&aux);
+        uint64_t wt = wtime();
+        uint64_t end = __rdtscp(&aux);
+        if (end - begin < window)
+        {
+            window = end - begin;
+            point.tsc = begin + (end - begin) / 2;
+            point.wtime = wt;
+        }
+    }
+
+    pthread_mutex_lock(&tsc_lock);
+    if (tsc_points_size == tsc_points_capacity)
+    {
+        size_t capacity = tsc_points_capacity ? 2 * tsc_points_capacity : 64;
+        struct tsc_point* points = realloc(tsc_points, capacity * sizeof(struct tsc_point));
+        if (points == NULL)
+        {
+            pthread_mutex_unlock(&tsc_lock);
+            return;
+        }
+        tsc_points = points;
+        tsc_points_capacity = capacity;
+    }
+    tsc_points[tsc_points_size++] = point;
+    __atomic_store_n(&tsc_last_ns, now, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&tsc_lock);
+}
+
+/* maps the TSC timestamps of the samples to wtime() with a fit of all calibration points */
+static void tsc_to_wtime(timevalue_t* samples, size_t count)
+{
+    pthread_mutex_lock(&tsc_lock);
+    if (tsc_points_size == 0)
+    {
+        pthread_mutex_unlock(&tsc_lock);
+        return;
+    }
+    /* relative to the first point, so the doubles keep their precision */
+    if (tsc_fit_size != tsc_points_size)
+    {
+        double sxx = 0.0, sxy = 0.0;
+        tsc_fit_x = 0.0;
+        tsc_fit_y = 0.0;
+        for (size_t i = 0; i < tsc_points_size; i++)
+        {
+            tsc_fit_x += (double)(tsc_points[i].tsc - tsc_points[0].tsc) / tsc_points_size;
+            tsc_fit_y += (double)(int64_t)(tsc_points[i].wtime - tsc_points[0].wtime) /
+                         tsc_points_size;
+        }
+        for (size_t i = 0; i < tsc_points_size; i++)
+        {
+            double dx = (double)(tsc_points[i].tsc - tsc_points[0].tsc) - tsc_fit_x;
+            double dy = (double)(int64_t)(tsc_points[i].wtime - tsc_points[0].wtime) - tsc_fit_y;
+            sxx += dx * dx;
+            sxy += dx * dy;
+        }
+        tsc_fit_slope = sxx > 0.0 ? sxy / sxx : 0.0;
+        tsc_fit_size = tsc_points_size;
+    }
+    struct tsc_point base = tsc_points[0];
+    double x = tsc_fit_x, y = tsc_fit_y, slope = tsc_fit_slope;
+    pthread_mutex_unlock(&tsc_lock);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        double dx = (double)(int64_t)(samples[i].timestamp - base.tsc) - x;
+        samples[i].timestamp = base.wtime + (int64_t)llround(y + slope * dx);
+    }
+}
+
+/* Merges adjacent samples of a full buffer in place and halves the resolution of new samples.
+ * The first sample is kept as the base of accumulated counters, each later pair becomes its
+ * second sample, so the counts between any two remaining samples stay exact. Pairs of doubles
+ * are averaged instead. */
+static void decimate(struct event* evt)
+{
+    timevalue_t* samples = evt->result_vector;
+    size_t count = evt->data_count;
+    size_t kept = 1;
+    int is_double = event_is_double(evt);
+
+    for (size_t i = 1; i + 1 < count; i += 2)
+    {
+        /* samples[kept] may alias samples[i], so read the pair before writing */
+        timevalue_t merged = samples[i + 1];
+        if (is_double)
+        {
+            double a, b;
+            memcpy(&a, &(samples[i].value), sizeof(a));
+            memcpy(&b, &(samples[i + 1].value), sizeof(b));
+            a = (a + b) / 2;
+            memcpy(&(merged.value), &a, sizeof(a));
+        }
+        samples[kept++] = merged;
+    }
+    if (count % 2 == 0)
+    {
+        samples[kept++] = samples[count - 1];
+    }
+    evt->decimation++;
+    evt->decimation_skipped = 0;
+    evt->decimation_sum = 0.0;
+    __atomic_store_n(&(evt->data_count), kept, __ATOMIC_RELEASE);
+}
+
+/* only every 2^decimation-th sample of a decimated event is stored */
+static inline int skip_sample(struct event* evt)
+{
+    if (evt->decimation == 0)
+    {
+        return 0;
+    }
+    if (++evt->decimation_skipped < (1u << evt->decimation))
+    {
+        return 1;
+    }
+    evt->decimation_skipped = 0;
+    return 0;
+}
+
+/* returns 0 and disables the event if its buffer is exhausted */
+static inline int check_buffer(struct event* evt, size_t num_buf_elems)
+{
+    if (evt->data_count >= num_buf_elems && !ring_buffers)
+    {
+        if (decimate_buffers && num_buf_elems > 2 && evt->decimation < 31)
+        {
+            decimate(evt);
+            return 1;
+        }
+        evt->enabled = 0;
+        fprintf(stderr, "Buffer reached maximum %zuB. Loosing events.\n", (buf_size));
+        fprintf(stderr, "Set UPE_BUF_SIZE environment variable to increase buffer size\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* Publishes the latest sample in the live view. The rate is taken over the time since the sample
+ * it was last computed from, readings drained in bulk (BPF) therefore give the average rate
+ * between two drains. */
+static void publish_live(struct event* evt, uint64_t value)
+{
+    struct upe_live_event* entry = evt->live;
+    uint64_t now = get_time_ns();
+
+    upe_live_write_begin(&(entry->seq));
+    if (!entry->is_double && now > evt->live_ns)
+    {
+        if (evt->live_ns > 0)
+        {
+            entry->rate = (double)(value - evt->live_value) * 1e9 / (now - evt->live_ns);
+        }
+        evt->live_value = value;
+        evt->live_ns = now;
+    }
+    entry->timestamp = now;
+    entry->value = value;
+    entry->samples = evt->data_count;
+    upe_live_write_end(&(entry->seq));
+}
+
+/* appends a sample, data_count is published last, so others never see an incomplete sample */
+static inline void store_sample(struct event* evt, uint64_t timestamp, uint64_t value,
+                                size_t num_buf_elems)
+{
+    timevalue_t* sample = &(evt->result_vector[evt->data_count % num_buf_elems]);
+    sample->timestamp = timestamp;
+    sample->value = value;
+    __atomic_store_n(&(evt->data_count), evt->data_count + 1, __ATOMIC_RELEASE);
+    if (evt->live != NULL)
+    {
+        publish_live(evt, value);
+    }
+}
+
+static inline void store_double(struct event* evt, uint64_t timestamp, double value,
+                                size_t num_buf_elems)
+{
+    uint64_t bits;
+    if (evt->enabled && check_buffer(evt, num_buf_elems))
+    {
+        if (evt->decimation > 0)
+        {
+            evt->decimation_sum += value;
+            if (skip_sample(evt))
+            {
+                return;
+            }
+            value = evt->decimation_sum / (1u << evt->decimation);
+            evt->decimation_sum = 0.0;
+        }
+        memcpy(&bits, &value, sizeof(bits));
+        store_sample(evt, timestamp, bits, num_buf_elems);
+    }
+}
+
+static inline uint32_t hist_bucket(uint64_t value)
+{
+    if (value < (1 << HIST_SUB_BITS))
+    {
+        return value;
+    }
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    uint32_t sub = (value >> (exponent - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return ((exponent - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+/* the middle of the values that fall into a bucket */
+static inline double hist_value(uint32_t bucket)
+{
+    if (bucket < (1 << HIST_SUB_BITS))
+    {
+        return bucket;
+    }
+    uint32_t exponent = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << HIST_SUB_BITS) - 1);
+    double width = (double)(1ull << (exponent - HIST_SUB_BITS));
+    return (double)(1ull << exponent) + (sub + 0.5) * width;
+}
+
+/* records the statistics of the window and the counter value at its end */
+static void emit_summary(struct event* evt, uint64_t timestamp, uint64_t value,
+                         size_t num_buf_elems)
+{
+    struct event_summary* summary = evt->summary;
+    uint64_t rank = summary->n - summary->n / 100, seen = 0;
+    double p99 = 0;
+
+    for (uint32_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += summary->hist[i];
+        if (seen >= rank)
+        {
+            p99 = hist_value(i);
+            break;
+        }
+    }
+    store_sample(evt, timestamp, value, num_buf_elems);
+    store_double(summary->stats[SUMMARY_MIN], timestamp, summary->min, num_buf_elems);
+    store_double(summary->stats[SUMMARY_AVG], timestamp, summary->mean, num_buf_elems);
+    store_double(summary->stats[SUMMARY_MAX], timestamp, summary->max, num_buf_elems);
+    store_double(summary->stats[SUMMARY_STDDEV], timestamp,
+                 summary->n > 1 ? sqrt(summary->m2 / (summary->n - 1)) : 0.0, num_buf_elems);
+    store_double(summary->stats[SUMMARY_P99], timestamp, p99, num_buf_elems);
+
+    summary->n = 0;
+    summary->mean = 0;
+    summary->m2 = 0;
+    memset(summary->hist, 0, sizeof(summary->hist));
+}
+
+/* updates the statistics with the rate since the previous sample, in events per second */
+static void summarize_sample(struct event* evt, uint64_t timestamp, uint64_t value,
+                             size_t num_buf_elems)
+{
+    struct event_summary* summary = evt->summary;
+    uint64_t now = get_time_ns();
+
+    if (summary->last_ns == 0)
+    {
+        summary->window_begin = now;
+    }
+    else if (now > summary->last_ns)
+    {
+        double rate = (double)(value - summary->last_value) * 1e9 / (now - summary->last_ns);
+        double delta = rate - summary->mean;
+        summary->n++;
+        summary->mean += delta / summary->n;
+        summary->m2 += delta * (rate - summary->mean);
+        if (summary->n == 1 || rate < summary->min)
+            summary->min = rate;
+        if (summary->n == 1 || rate > summary->max)
+            summary->max = rate;
+        summary->hist[hist_bucket(rate)]++;
+    }
+    summary->last_ns = now;
+    summary->last_value = value;
+
+    if (now - summary->window_begin >= summary_ns && summary->n > 0)
+    {
+        emit_summary(evt, timestamp, value, num_buf_elems);
+        summary->window_begin = now;
+    }
+}
+
+/* takes the next free slot of the marks, returns 0 and disables the event if the buffer is full */
+static int reserve_marker(struct event* evt, uint64_t* slot)
+{
+    size_t num_buf_elems = buf_size / sizeof(timevalue_t);
+
+    *slot = __atomic_load_n(&marker_count, __ATOMIC_RELAXED);
+    do
+    {
+        if (!ring_buffers &&
+            *slot - __atomic_load_n(&marker_drained, __ATOMIC_ACQUIRE) >= num_buf_elems)
+        {
+            if (__atomic_exchange_n(&(evt->enabled), 0, __ATOMIC_SEQ_CST))
+            {
+                fprintf(stderr, "Buffer reached maximum %zuB. Loosing events.\n", (buf_size));
+                fprintf(stderr, "Set UPE_BUF_SIZE environment variable to increase buffer size\n");
+            }
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&marker_count, slot, *slot + 1, 1, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    return 1;
+}
+
+/* The value of a marker is its number. A mark waits only for the marks numbered before it, which
+ * are being stored by other threads right now, so the samples stay in order. Marks are not
+ * decimated. */
+static void record_marker(void)
+{
+    struct event* evt = marker_event;
+    uint64_t slot;
+
+    if (evt == NULL)
+    {
+        return;
+    }
+    /* get_all_values() disables the event and then waits until no writer is left */
+    __atomic_fetch_add(&marker_writers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(evt->enabled), __ATOMIC_SEQ_CST) && reserve_marker(evt, &slot))
+    {
+        while (__atomic_load_n(&marker_stored, __ATOMIC_ACQUIRE) != slot)
+        {
+            sched_yield();
+        }
+        store_sample(evt, sample_time(), slot + 1, buf_size / sizeof(timevalue_t));
+        __atomic_store_n(&marker_stored, slot + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_sub(&marker_writers, 1, __ATOMIC_RELEASE);
+}
+
+/* pauses the samplers for good, upe_control() and the signals can not resume them */
+static void freeze_flight_recorder(void)
+{
+    if (!__atomic_exchange_n(&flight_frozen, 1, __ATOMIC_ACQ_REL))
+    {
+        set_paused(1);
+    }
+}
+
+/* freezes the window once UPE_FLIGHT_POST_US have passed since the trigger */
+static inline void check_flight_recorder(void)
+{
+    uint64_t freeze_ns = __atomic_load_n(&flight_freeze_ns, __ATOMIC_ACQUIRE);
+    if (freeze_ns > 0 && get_time_ns() >= freeze_ns)
+    {
+        freeze_flight_recorder();
+    }
+}
+
+/* Only the first trigger counts. It is recorded as a mark if upe:markers is recorded. Returns -1
+ * without the flight recorder. */
+static int trigger_flight_recorder(void)
+{
+    uint64_t expected = 0;
+
+    if (!flight_recorder)
+    {
+        return -1;
+    }
+    if (__atomic_compare_exchange_n(&flight_freeze_ns, &expected, get_time_ns() + flight_post_ns,
+                                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        record_marker();
+        if (flight_post_ns == 0)
+        {
+            freeze_flight_recorder();
+        }
+    }
+    return 0;
+}
+
+/* fires the trigger if the rate of the event since its previous sample crosses UPE_TRIGGER */
+static void check_trigger(struct event* evt, uint64_t value)
+{
+    uint64_t now = get_time_ns();
+
+    if (evt->trigger_ns > 0 && now > evt->trigger_ns)
+    {
+        double rate = (double)(value - evt->trigger_value) * 1e9 / (now - evt->trigger_ns);
+        if (trigger_above ? rate > trigger_rate : rate < trigger_rate)
+        {
+            trigger_flight_recorder();
+        }
+    }
+    evt->trigger_value = value;
+    evt->trigger_ns = now;
+}
+
+/* Tracks the relative change of the rate of the event between its last two samples. The rate is
+ * taken in the units of the sample clock, which cancel out. */
+static inline void track_rate(struct event* evt, uint64_t timestamp, uint64_t value)
+{
+    if (evt->adapt_timestamp > 0 && timestamp > evt->adapt_timestamp)
+    {
+        double rate = (double)(value - evt->adapt_value) / (timestamp - evt->adapt_timestamp);
+        double base = fmax(rate, evt->adapt_rate);
+        evt->adapt_change = base > 0.0 ? fabs(rate - evt->adapt_rate) / base : 0.0;
+        evt->adapt_rate = rate;
+    }
+    evt->adapt_value = value;
+    evt->adapt_timestamp = timestamp;
+}
+
+/* appends a sample of a counter, or only updates its statistics in summary mode */
+static inline void push_sample(struct event* evt, uint64_t timestamp, uint64_t value,
+                               size_t num_buf_elems)
+{
+    if (adaptive_max_us > 0)
+    {
+        track_rate(evt, timestamp, value);
+    }
+    if (evt->trigger)
+    {
+        check_trigger(evt, value);
+    }
+    if (evt->summary != NULL)
+    {
+        summarize_sample(evt, timestamp, value, num_buf_elems);
+        return;
+    }
+    /* skipped counts are contained in the next stored sample */
+    if (skip_sample(evt))
+    {
+        return;
+    }
+    store_sample(evt, timestamp, value, num_buf_elems);
+}
+
+static inline void read_events(struct event** local_event, int32_t local_event_size,
+                               size_t num_buf_elems)
+{
+    uint64_t timestamp, timestamp2;
+
+    /* measure time for each msr read */
+    for (int i = 0; i < local_event_size; i++)
+    {
+        if (local_event[i]->enabled && check_buffer(local_event[i], num_buf_elems))
+        {
+            /* measure time and read value */
+            timestamp = sample_time();
+            uint64_t value = uncore_perf_read(local_event[i]);
+            timestamp2 = sample_time();
+            push_sample(local_event[i], timestamp + ((timestamp2 - timestamp) >> 1), value,
+                        num_buf_elems);
+        }
+    }
+}
+
+#ifndef UNCORE_BOXES
+static inline void store_perf_reading(struct event* evt, uint64_t timestamp,
+                                      const struct perf_read_format* raw, double scale,
+                                      size_t num_buf_elems)
+{
+    push_sample(evt, timestamp, perf_scale(evt, raw, scale), num_buf_elems);
+
+    /* share of the last interval in which the event was actually counted */
+    struct event* ratio = evt->mux_ratio;
+    if (ratio != NULL)
+    {
+        uint64_t enabled = raw->time_enabled - evt->time_enabled;
+        uint64_t running = raw->time_running - evt->time_running;
+        store_double(ratio, timestamp, enabled ? (double)running / enabled : 1.0,
+                     num_buf_elems);
+    }
+    evt->time_enabled = raw->time_enabled;
+    evt->time_running = raw->time_running;
+}
+
+/* Read all perf counters of the sampler first and scale them afterwards in one pass over plain
+ * arrays, which the compiler can vectorize. */
+static inline void read_perf_events(struct event** local_event, int32_t local_event_size,
+                                    size_t num_buf_elems)
+{
+    if (local_event_size == 0)
+    {
+        return;
+    }
+    struct event* snapshot[local_event_size];
+    struct perf_read_format raw[local_event_size];
+    uint64_t timestamp[local_event_size];
+    double scale[local_event_size];
+    int32_t snapshot_size = 0;
+    uint64_t timestamp2;
+
+    for (int i = 0; i < local_event_size; i++)
+    {
+        if (local_event[i]->enabled && check_buffer(local_event[i], num_buf_elems))
+        {
+            timestamp[snapshot_size] = sample_time();
+            if (read(local_event[i]->fd, &(raw[snapshot_size]), sizeof(raw[0])) != sizeof(raw[0]))
+            {
+                fprintf(stderr, "Error while reading event %s\n", local_event[i]->name);
+                fprintf(stderr, "%s\n", strerror(errno));
+                continue;
+            }
+            timestamp2 = sample_time();
+            timestamp[snapshot_size] += (timestamp2 - timestamp[snapshot_size]) >> 1;
+            snapshot[snapshot_size++] = local_event[i];
+        }
+    }
+
+    /* no branches here, an event that never ran has a value of 0 anyway */
+    for (int i = 0; i < snapshot_size; i++)
+    {
+        double running = raw[i].time_running;
+        scale[i] = raw[i].time_enabled / (running > 0.0 ? running : 1.0);
+    }
+
+    for (int i = 0; i < snapshot_size; i++)
+    {
+        store_perf_reading(snapshot[i], timestamp[i], &(raw[i]), scale[i], num_buf_elems);
+    }
+}
+#endif
+
+#ifdef UNCORE_BOXES
+
+/* Read all counters of the sampler in one batch. If stats is given, the die is frozen while
+ * reading, so all values of one tick belong to the same instant. */
+static inline void read_events_batch(struct event** local_event, int32_t local_event_size,
+                                     size_t num_buf_elems, struct freeze_stats* stats)
+{
+    if (local_event_size == 0)
+    {
+        return;
+    }
+    struct event* snapshot[local_event_size];
+    uint64_t values[local_event_size];
+    int32_t snapshot_size = 0;
+    uint64_t timestamp, timestamp2, begin, window;
+    int32_t ret;
+
+    for (int i = 0; i < local_event_size; i++)
+    {
+        if (local_event[i]->enabled && check_buffer(local_event[i], num_buf_elems))
+        {
+            snapshot[snapshot_size++] = local_event[i];
+        }
+    }
+    if (snapshot_size == 0)
+    {
+        return;
+    }
+
+    /* all events of a sampler live on the same die and share the die device */
+    timestamp = sample_time();
+    begin = get_time_ns();
+    if (stats != NULL && x86a_freeze(snapshot[0]->fd, snapshot[0]->node))
+    {
+        return;
+    }
+    ret = x86a_read_counters(snapshot, snapshot_size, values);
+    if (stats != NULL)
+        x86a_unfreeze(snapshot[0]->fd, snapshot[0]->node);
+    window = get_time_ns() - begin;
+    timestamp2 = sample_time();
+    if (ret)
+    {
+        return;
+    }
+
+    for (int i = 0; i < snapshot_size; i++)
+    {
+        push_sample(snapshot[i], timestamp + ((timestamp2 - timestamp) >> 1), values[i],
+                    num_buf_elems);
+    }
+
+    if (stats == NULL)
+        return;
+    if (stats->count == 0 || window < stats->min_ns)
+        stats->min_ns = window;
+    if (window > stats->max_ns)
+        stats->max_ns = window;
+    stats->sum_ns += window;
+    stats->count++;
+}
+#endif
+
+static int32_t count_enabled(struct event** local_event, int32_t local_event_size)
+{
+    int32_t count = 0;
+    for (int i = 0; i < local_event_size; i++)
+    {
+        count += local_event[i]->enabled;
+    }
+    return count;
+}
+
+/* reads all enabled events once without storing the values */
+static void read_round(struct event** counter_event, int32_t counter_event_size,
+                       struct event** local_event, int32_t local_event_size)
+{
+#ifdef UNCORE_BOXES
+    if (counter_event_size > 0)
+    {
+        struct event* snapshot[counter_event_size];
+        uint64_t values[counter_event_size];
+        int32_t snapshot_size = 0;
+
+        for (int i = 0; i < counter_event_size; i++)
+        {
+            if (counter_event[i]->enabled)
+            {
+                snapshot[snapshot_size++] = counter_event[i];
+            }
+        }
+        if (snapshot_size > 0)
+        {
+            x86a_read_counters(snapshot, snapshot_size, values);
+        }
+    }
+#else
+    for (int i = 0; i < counter_event_size; i++)
+    {
+        if (counter_event[i]->enabled)
+        {
+            uncore_perf_read(counter_event[i]);
+        }
+    }
+#endif
+    for (int i = 0; i < local_event_size; i++)
+    {
+        if (local_event[i]->enabled)
+        {
+            uncore_perf_read(local_event[i]);
+        }
+    }
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Returns the median time in nsecs to read the enabled events of a sampler once. With an overhead
+ * budget, *interval becomes the shortest interval within the budget that still reads narrow
+ * counters twice before they wrap. */
+static uint64_t calibrate_sampler(struct event** counter_event, int32_t counter_event_size,
+                                  struct event** local_event, int32_t local_event_size,
+                                  uint64_t* interval)
+{
+    uint64_t cost[CALIBRATION_ROUNDS];
+    double wrap_us = (double)UINT64_MAX;
+
+    for (int i = 0; i < CALIBRATION_ROUNDS; i++)
+    {
+        uint64_t begin = get_time_ns();
+        read_round(counter_event, counter_event_size, local_event, local_event_size);
+        cost[i] = get_time_ns() - begin;
+    }
+    qsort(cost, CALIBRATION_ROUNDS, sizeof(uint64_t), compare_u64);
+    if (overhead_budget <= 0.0)
+    {
+        return cost[CALIBRATION_ROUNDS / 2];
+    }
+
+    for (int i = 0; i < local_event_size; i++)
+    {
+        if (local_event[i]->enabled && local_event[i]->ctr_mask != UINT64_MAX)
+        {
+            double us = (local_event[i]->ctr_mask + 1.0) / MAX_COUNTER_RATE * 1e6 / 2;
+            wrap_us = us < wrap_us ? us : wrap_us;
+        }
+    }
+    *interval = ceil(cost[CALIBRATION_ROUNDS / 2] / 1000.0 / overhead_budget);
+    if (*interval < min_interval_us)
+    {
+        *interval = min_interval_us;
+    }
+    if (*interval > wrap_us)
+    {
+        fprintf(stderr,
+                "Reading the events on cpu %d every %" PRIu64 " us exceeds the overhead budget, "
+                "but is needed to catch counter wraps\n",
+                sched_getcpu(), (uint64_t)wrap_us);
+        *interval = wrap_us > 1.0 ? wrap_us : 1;
+    }
+    return cost[CALIBRATION_ROUNDS / 2];
+}
+
+/* largest relative change of the rates of the enabled events at their last samples */
+static double max_rate_change(struct event** local_event, int32_t local_event_size)
+{
+    double change = 0.0;
+    for (int i = 0; i < local_event_size; i++)
+    {
+        if (local_event[i]->enabled && local_event[i]->adapt_change > change)
+        {
+            change = local_event[i]->adapt_change;
+        }
+    }
+    return change;
 }
 
-static inline uint64_t uncore_perf_read(struct event* evt)
+/* Returns the next interval of a sampler in adaptive mode: half the interval during transitions,
+ * so they are resolved densely, and an eighth more per stable tick, down to min_us and up to
+ * UPE_ADAPTIVE_US's maximum. */
+static uint64_t adapt_interval(const struct sampler_list* counters,
+                               const struct sampler_list* locals, uint64_t interval,
+                               uint64_t min_us)
 {
-    uint64_t data;
-    ssize_t ret;
-#ifdef X86_ADAPT
-    ret = x86_adapt_get_setting(evt->fd, evt->item, &data);
-    if (!ret)
+    double change = fmax(max_rate_change(counters->events, counters->size),
+                         max_rate_change(locals->events, locals->size));
+
+    if (change > adaptive_change)
     {
-        fprintf(stderr, "Error while reading event %s\n", evt->name);
-        return 0;
+        interval /= 2;
     }
-#else
-    ret = read(evt->fd, &data, sizeof(data));
-    if (ret != sizeof(data))
+    else
     {
-        fprintf(stderr, "Error while reading event %s\n", evt->name);
-        fprintf(stderr, "%s\n", strerror(errno));
-        return 0;
+        interval += interval / 8 + 1;
     }
-#endif
-    return data;
+    if (interval < min_us)
+    {
+        interval = min_us;
+    }
+    if (interval > adaptive_max_us)
+    {
+        interval = adaptive_max_us;
+    }
+    return interval;
 }
 
-#ifndef METRIC_SYNC
-static inline uint64_t get_time()
+/* records the interval, or the cost of reading the events once, of a sampler */
+static void store_calibration(const struct sampler_list* calibration, uint64_t interval,
+                              uint64_t cost, size_t num_buf_elems)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_usec + tv.tv_sec * 1000000;
+    for (int i = 0; i < calibration->size; i++)
+    {
+        struct event* evt = calibration->events[i];
+        if (evt->enabled && check_buffer(evt, num_buf_elems))
+        {
+            store_sample(evt, sample_time(), evt->type == EVENT_INTERVAL ? interval : cost,
+                         num_buf_elems);
+        }
+    }
 }
 
 void* thread_report(void* _cpu)
 {
     int32_t cpu = (int32_t)_cpu;
-    uint64_t timestamp, timestamp2;
     uint64_t time_in_us, time_next_us = 0;
     size_t num_buf_elems = buf_size / sizeof(timevalue_t);
-    struct event* local_event[MAX_EVENTS] = { 0 };
-    int32_t local_event_size = 0;
+    /* counters are read in one batch, the others one by one */
+    struct sampler_list counters = { 0 };
+    struct sampler_list locals = { 0 };
+    struct sampler_list calibration = { 0 };
+    int32_t sorted = 0; /* events of sampler_lists[cpu] that are sorted into the lists above */
+    uint64_t sampler_interval_us = interval_us;
+    uint64_t budget_interval_us = adaptive_min_us; /* lower bound in adaptive mode */
+    uint64_t cost = 0;
+    int32_t calibrated = -1;
+    struct upe_live_sampler* live_sampler = NULL;
 
     /* pin thread to cpu */
     cpu_set_t cpu_mask;
@@ -481,73 +2894,284 @@ void* thread_report(void* _cpu)
     CPU_SET(cpu, &cpu_mask);
     sched_setaffinity(0, sizeof(cpu_set_t), &cpu_mask);
 
-    /* copy local events */
-    for (int i = 0; i < event_list_size; i++)
+    if (live_view.map != NULL && (uint32_t)cpu < live_view.header->sampler_count)
     {
-        if (event_list[i].cpu == cpu)
-        {
-            local_event[local_event_size] = &(event_list[i]);
-            local_event_size++;
-        }
+        live_sampler = &(live_view.samplers[cpu]);
+        live_sampler->cpu = cpu;
     }
 
-    while (thread_enabled[cpu])
+    while (1)
     {
+        wait_while_paused();
+        if (!thread_enabled[cpu])
+            break;
         if (wtime == NULL)
-            return NULL;
-        /* measure time for each msr read */
-        for (int i = 0; i < local_event_size; i++)
+            break;
+        /* a ring during the read leads to another sample */
+        uint32_t rung = __atomic_load_n(&doorbell, __ATOMIC_ACQUIRE);
+        uint64_t tick_begin = live_sampler != NULL ? get_time_ns() : 0;
+        pthread_mutex_lock(&(sampler_locks[cpu]));
+        /* events registered since the last tick */
+        for (; sorted < sampler_lists[cpu].size; sorted++)
         {
-            if (local_event[i]->enabled)
+            struct event* evt = sampler_lists[cpu].events[sorted];
+            if (evt->type == EVENT_COUNTER)
             {
-                if (local_event[i]->data_count >= num_buf_elems)
-                {
-                    local_event[i]->enabled = 0;
-                    fprintf(stderr, "Buffer reached maximum %zuB. Loosing events.\n", (buf_size));
-                    fprintf(stderr,
-                            "Set UPE_BUF_SIZE environment variable to increase buffer size\n");
-                }
-                else
+#ifdef BPF_SAMPLING
+                if (bpf_active)
                 {
-                    /* measure time and read value */
-                    timestamp = wtime();
-                    local_event[i]->result_vector[local_event[i]->data_count].value =
-                        uncore_perf_read(local_event[i]);
-                    timestamp2 = wtime();
-                    local_event[i]->result_vector[local_event[i]->data_count].timestamp =
-                        timestamp + ((timestamp2 - timestamp) >> 1);
-                    local_event[i]->data_count++;
+                    continue;
                 }
+#endif
+                append_event(&counters, evt);
+            }
+            else if (evt->type == EVENT_MMIO)
+            {
+                append_event(&locals, evt);
+            }
+            else if (evt->type == EVENT_INTERVAL || evt->type == EVENT_READ_COST)
+            {
+                append_event(&calibration, evt);
+            }
+        }
+        /* events are enabled one by one in add_counter(), so the cost is measured again when
+         * the set of events changes */
+        if (overhead_budget > 0.0 || calibration.size > 0)
+        {
+            int32_t enabled = count_enabled(counters.events, counters.size) +
+                              count_enabled(locals.events, locals.size) +
+                              count_enabled(calibration.events, calibration.size);
+            if (enabled != calibrated)
+            {
+                cost = calibrate_sampler(counters.events, counters.size, locals.events,
+                                         locals.size, adaptive_max_us > 0 ? &budget_interval_us
+                                                                          : &sampler_interval_us);
+                store_calibration(&calibration, sampler_interval_us, cost, num_buf_elems);
+                calibrated = enabled;
+            }
+        }
+#ifdef UNCORE_BOXES
+        read_events_batch(counters.events, counters.size, num_buf_elems,
+                          freeze_enabled ? &(freeze_stats[cpu]) : NULL);
+#else
+        read_perf_events(counters.events, counters.size, num_buf_elems);
+#endif
+        read_events(locals.events, locals.size, num_buf_elems);
+        if (adaptive_max_us > 0)
+        {
+            uint64_t adapted =
+                adapt_interval(&counters, &locals, sampler_interval_us, budget_interval_us);
+            if (adapted != sampler_interval_us)
+            {
+                sampler_interval_us = adapted;
+                store_calibration(&calibration, sampler_interval_us, cost, num_buf_elems);
             }
         }
+        pthread_mutex_unlock(&(sampler_locks[cpu]));
+        check_flight_recorder();
+        if (tsc_enabled)
+        {
+            tsc_checkpoint(TSC_CALIBRATION_NS);
+        }
+        if (live_sampler != NULL)
+        {
+            uint64_t tick_end = get_time_ns();
+            upe_live_write_begin(&(live_sampler->seq));
+            live_sampler->ticks++;
+            live_sampler->last_tick = tick_end;
+            live_sampler->read_ns = tick_end - tick_begin;
+            if (live_sampler->read_ns > live_sampler->max_read_ns)
+                live_sampler->max_read_ns = live_sampler->read_ns;
+            upe_live_write_end(&(live_sampler->seq));
+        }
         time_in_us = get_time();
-        time_next_us = time_in_us + interval_us - time_in_us % (interval_us);
-        usleep(time_next_us - time_in_us);
+        if (adaptive_max_us > 0)
+        {
+            /* ticks aligned to multiples of a changing interval would be arbitrarily short */
+            time_next_us += sampler_interval_us;
+            if (time_next_us <= time_in_us)
+            {
+                time_next_us = time_in_us + sampler_interval_us;
+            }
+        }
+        else
+        {
+            time_next_us = time_in_us + sampler_interval_us - time_in_us % sampler_interval_us;
+        }
+        wait_for_tick(rung, time_next_us - time_in_us);
+    }
+    free(counters.events);
+    free(locals.events);
+    free(calibration.events);
+    return NULL;
+}
+
+#ifdef BPF_SAMPLING
+static void store_bpf_record(struct event* evt, const struct upe_bpf_record* record)
+{
+    size_t num_buf_elems = buf_size / sizeof(timevalue_t);
+    struct perf_read_format raw = { record->value, record->time_enabled, record->time_running };
+    uint64_t timestamp = bpf_wtime_begin;
+
+    if (!evt->enabled || !check_buffer(evt, num_buf_elems))
+    {
+        return;
+    }
+    if (bpf_mono_end > bpf_mono_begin)
+    {
+        timestamp += (double)((int64_t)(record->timestamp - bpf_mono_begin)) *
+                     (bpf_wtime_end - bpf_wtime_begin) / (bpf_mono_end - bpf_mono_begin);
+    }
+    store_perf_reading(evt, timestamp, &raw,
+                       raw.time_running ? (double)raw.time_enabled / raw.time_running : 0.0,
+                       num_buf_elems);
+}
+
+static void bpf_drain(void)
+{
+    pthread_mutex_lock(&bpf_lock);
+    bpf_mono_end = get_time_ns();
+    bpf_wtime_end = sample_time();
+    bpf_sampling_drain();
+    pthread_mutex_unlock(&bpf_lock);
+}
+
+/* replaces the sampling threads for the perf counters */
+static void* bpf_drain_thread(void* arg)
+{
+    while (bpf_thread_enabled)
+    {
+        uint32_t rung = __atomic_load_n(&doorbell, __ATOMIC_ACQUIRE);
+        bpf_drain();
+        check_flight_recorder();
+        if (tsc_enabled)
+        {
+            tsc_checkpoint(TSC_CALIBRATION_NS);
+        }
+        wait_for_tick(rung, BPF_DRAIN_US);
     }
     return NULL;
 }
+
+static void start_bpf_sampling(void)
+{
+    if (!bpf_enabled)
+    {
+        return;
+    }
+    if (summary_ns > 0)
+    {
+        fprintf(stderr, "UPE_BPF can not be used with UPE_SUMMARY_US, using the sampling "
+                        "threads\n");
+        return;
+    }
+    if (bpf_sampling_init(interval_us * 1000ull, buf_size, store_bpf_record))
+    {
+        fprintf(stderr, "Could not load the BPF sampling program, using the sampling threads\n");
+        return;
+    }
+    bpf_mono_begin = get_time_ns();
+    bpf_wtime_begin = sample_time();
+    bpf_thread_enabled = 1;
+    if (pthread_create(&bpf_thread, NULL, bpf_drain_thread, NULL))
+    {
+        fprintf(stderr, "Failed to create the BPF drain thread, using the sampling threads\n");
+        bpf_thread_enabled = 0;
+        bpf_sampling_fini();
+        return;
+    }
+    bpf_active = 1;
+    if (samplers_paused)
+    {
+        bpf_sampling_pause(1);
+    }
+}
+#endif
+#endif
+
+int upe_control(enum upe_control_command command)
+{
+#ifdef METRIC_SYNC
+    return -1;
+#else
+    switch (command)
+    {
+    case UPE_CONTROL_START:
+        if (__atomic_load_n(&flight_frozen, __ATOMIC_ACQUIRE))
+        {
+            return -1;
+        }
+        set_paused(0);
+        return 0;
+    case UPE_CONTROL_STOP:
+        set_paused(1);
+        return 0;
+    case UPE_CONTROL_MARK:
+        return upe_mark();
+    case UPE_CONTROL_TRIGGER:
+        return trigger_flight_recorder();
+    }
+    return -1;
+#endif
+}
+
+int upe_mark(void)
+{
+#ifdef METRIC_SYNC
+    return -1;
+#else
+    record_marker();
+    ring_doorbell();
+    return 0;
 #endif
+}
 
 int32_t add_counter(char* event_name)
 {
-#ifdef X86_ADAPT
-    static int32_t once = 0;
-    if (!once)
+#ifdef UNCORE_BOXES
+    if (!boxes_programmed)
     {
-        int32_t ret = x86a_unfreeze_all();
+        /* nothing is requested yet, counters are programmed as soon as they are set up */
+        int32_t ret = x86a_program_counters();
+        if (ret)
+        {
+            return ret;
+        }
+        ret = x86a_unfreeze_all();
         if (ret)
         {
             return ret;
         }
-        once = 1;
+        boxes_programmed = 1;
     }
 #endif
 #ifndef METRIC_SYNC
     if (!is_thread_created)
     {
+        /* the first calibration point, before any sample is taken */
+        if (tsc_enabled)
+        {
+            tsc_checkpoint(0);
+        }
+#ifdef BPF_SAMPLING
+        start_bpf_sampling();
+#endif
         for (int i = 0; i < event_list_size; i++)
         {
-            int cpu = event_list[i].cpu;
+            int cpu = event_list[i]->cpu;
+            /* events of the service are sampled by upe-record */
+            if (event_list[i]->type == EVENT_SERVICE || cpu < 0)
+            {
+                continue;
+            }
+#ifdef BPF_SAMPLING
+            /* the counters and their running ratios are sampled by the BPF program */
+            if (bpf_active &&
+                (event_list[i]->type == EVENT_COUNTER || event_list[i]->type == EVENT_MUX_RATIO))
+            {
+                continue;
+            }
+#endif
             if (!thread_enabled[cpu])
             {
                 thread_enabled[cpu] = 1;
@@ -562,54 +3186,356 @@ int32_t add_counter(char* event_name)
     }
 #endif
 
-    for (int i = 0; i < event_list_size; i++)
+    int32_t id = find_event(event_name);
+    if (id < 0)
     {
-        if (!strcmp(event_name, event_list[i].name))
-        {
-#ifndef X86_ADAPT
-            ioctl(event_list[i].fd, PERF_EVENT_IOC_RESET, 0);
-            ioctl(event_list[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        return -1;
+    }
+    struct event* evt = event_list[id];
+#ifndef METRIC_SYNC
+    if (evt->type == EVENT_SERVICE)
+    {
+        evt->service_begin = get_realtime_ns();
+        evt->wtime_begin = wtime();
+        evt->enabled = 1;
+        return id;
+    }
 #endif
-            event_list[i].enabled = 1;
-            return i;
+    if (acquire_event(evt))
+    {
+        return -1;
+    }
+#ifdef BPF_SAMPLING
+    if (bpf_active && evt->type == EVENT_COUNTER)
+    {
+        pthread_mutex_lock(&bpf_lock);
+        int32_t ret = bpf_sampling_add(evt);
+        pthread_mutex_unlock(&bpf_lock);
+        if (ret)
+        {
+            release_event(evt);
+            return -1;
         }
     }
-    return -1;
+#endif
+#ifdef UNCORE_BOXES
+    /* the event did not fit on its box, this was reported by x86a_setup_counter() */
+    if (evt->type == EVENT_COUNTER && evt->item < 0)
+    {
+        return id;
+    }
+#endif
+    evt->enabled = 1;
+    return id;
 }
 
 int enable_counter(int ID)
 {
-    event_list[ID].enabled = 1;
+    event_list[ID]->enabled = 1;
     return 0;
 }
 
 int disable_counter(int ID)
 {
-    event_list[ID].enabled = 0;
+    event_list[ID]->enabled = 0;
     return 0;
 }
 
 #ifdef METRIC_SYNC
 bool get_optional_value(int32_t id, uint64_t* value)
 {
-    if (sched_getcpu() == event_list[id].cpu)
+    if (sched_getcpu() == event_list[id]->cpu)
     {
-        *value = uncore_perf_read(&event_list[id]);
+        *value = uncore_perf_read(event_list[id]);
+        if (event_is_scaled(event_list[id]))
+        {
+            double scaled = *value * event_list[id]->scale;
+            memcpy(value, &scaled, sizeof(scaled));
+        }
         return true;
     }
     return false;
 }
 #else
+/* copies the samples the service took between add_counter() and now, the timestamps are mapped
+ * linearly from the clock of the service to the clock of the measurement */
+static uint64_t get_service_values(struct event* evt, timevalue_t** result)
+{
+    uint64_t end = get_realtime_ns();
+    uint64_t wtime_end = wtime();
+    uint64_t capacity = evt->service->header->capacity;
+    /* the service publishes its samples once per interval, periodic calls take what is there */
+    uint64_t deadline = drain_us > 0 ? end : end + 2000ull * evt->service->header->interval_us;
+    const struct upe_record_sample* samples;
+    uint64_t head, oldest, begin_idx, end_idx;
+
+    *result = NULL;
+    while (1)
+    {
+        samples = upe_record_samples(evt->service, evt->service_event, &head);
+        if (samples == NULL)
+        {
+            return 0;
+        }
+        if ((head > 0 && samples[(head - 1) % capacity].timestamp >= end) ||
+            get_realtime_ns() > deadline)
+        {
+            break;
+        }
+        usleep(1000);
+    }
+
+    /* walk back from the newest sample to the window */
+    oldest = head > capacity ? head - capacity : 0;
+    end_idx = head;
+    while (end_idx > oldest && samples[(end_idx - 1) % capacity].timestamp > end)
+        end_idx--;
+    begin_idx = end_idx;
+    while (begin_idx > oldest && samples[(begin_idx - 1) % capacity].timestamp >= evt->service_begin)
+        begin_idx--;
+    if (begin_idx == end_idx)
+    {
+        return 0;
+    }
+    uint64_t last = samples[(end_idx - 1) % capacity].timestamp;
+
+    *result = malloc((end_idx - begin_idx) * sizeof(timevalue_t));
+    if (*result == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for the values of %s\n", evt->name);
+        return 0;
+    }
+    double scale = 1.0;
+    if (end > evt->service_begin)
+    {
+        scale = (double)(wtime_end - evt->wtime_begin) / (end - evt->service_begin);
+    }
+    for (uint64_t i = begin_idx; i < end_idx; i++)
+    {
+        const struct upe_record_sample* sample = &(samples[i % capacity]);
+        (*result)[i - begin_idx].timestamp =
+            evt->wtime_begin + (int64_t)(sample->timestamp - evt->service_begin) * scale;
+        (*result)[i - begin_idx].value = sample->value;
+    }
+
+    /* drop samples that were overwritten by the service while copying */
+    upe_record_samples(evt->service, evt->service_event, &head);
+    oldest = head > capacity ? head - capacity : 0;
+    if (oldest > begin_idx)
+    {
+        uint64_t lost = oldest - begin_idx < end_idx - begin_idx ? oldest - begin_idx
+                                                                  : end_idx - begin_idx;
+        memmove(*result, *result + lost, (end_idx - begin_idx - lost) * sizeof(timevalue_t));
+        begin_idx += lost;
+    }
+    /* the next periodic call continues after the last sample */
+    if (drain_us > 0 && end_idx > begin_idx)
+    {
+        evt->wtime_begin = (*result)[end_idx - begin_idx - 1].timestamp;
+        evt->service_begin = last + 1;
+    }
+    return end_idx - begin_idx;
+}
+
+/* the lock under which the samples of the event are stored */
+static pthread_mutex_t* sample_lock(const struct event* evt)
+{
+#ifdef BPF_SAMPLING
+    if (bpf_active && (evt->type == EVENT_COUNTER || evt->type == EVENT_MUX_RATIO))
+    {
+        return &bpf_lock;
+    }
+#endif
+    return &(sampler_locks[evt->cpu]);
+}
+
+/* The marks are not moved within the buffer, as marks may be recorded at the same time. They are
+ * copied from the slots drained last time up to the ones stored now, which frees those slots. */
+static uint64_t drain_markers(struct event* evt, timevalue_t** result)
+{
+    size_t num_buf_elems = buf_size / sizeof(timevalue_t);
+    uint64_t begin = marker_drained;
+    uint64_t end = __atomic_load_n(&marker_stored, __ATOMIC_ACQUIRE);
+
+    if (end == begin)
+    {
+        return 0;
+    }
+    *result = malloc((end - begin) * sizeof(timevalue_t));
+    if (*result == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for the values of %s\n", evt->name);
+        return 0;
+    }
+    for (uint64_t i = begin; i < end; i++)
+    {
+        (*result)[i - begin] = evt->result_vector[i % num_buf_elems];
+    }
+    __atomic_store_n(&marker_drained, end, __ATOMIC_RELEASE);
+
+    if (tsc_enabled)
+    {
+        tsc_checkpoint(TSC_CALIBRATION_NS / 100);
+        tsc_to_wtime(*result, end - begin);
+    }
+    return end - begin;
+}
+
+/* Hands the samples taken since the previous call over and recycles the buffer. The counters
+ * keep running until fini(). The result is allocated for the samples seen before taking the lock,
+ * so the sampler is held up as shortly as possible. A full buffer may have been decimated in
+ * between, hence the count is checked again under the lock. */
+static uint64_t drain_values(struct event* evt, timevalue_t** result)
+{
+    *result = NULL;
+    if (evt->type == EVENT_SERVICE)
+    {
+        return get_service_values(evt, result);
+    }
+    if (evt->result_vector == NULL)
+    {
+        return 0;
+    }
+    if (evt->type == EVENT_MARKER)
+    {
+        return drain_markers(evt, result);
+    }
+#ifdef BPF_SAMPLING
+    if (bpf_active && evt->type == EVENT_COUNTER)
+    {
+        bpf_drain();
+    }
+#endif
+    size_t allocated = __atomic_load_n(&(evt->data_count), __ATOMIC_ACQUIRE);
+    if (allocated == 0)
+    {
+        return 0;
+    }
+    *result = malloc(allocated * sizeof(timevalue_t));
+    if (*result == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory for the values of %s\n", evt->name);
+        return 0;
+    }
+
+    pthread_mutex_t* lock = sample_lock(evt);
+    pthread_mutex_lock(lock);
+    size_t count = evt->data_count < allocated ? evt->data_count : allocated;
+    size_t later = evt->data_count - count;
+    memcpy(*result, evt->result_vector, count * sizeof(timevalue_t));
+    memmove(evt->result_vector, evt->result_vector + count, later * sizeof(timevalue_t));
+    /* the buffer is empty again, so new samples are kept at full resolution */
+    evt->decimation = 0;
+    evt->decimation_skipped = 0;
+    evt->decimation_sum = 0.0;
+    __atomic_store_n(&(evt->data_count), later, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(lock);
+
+    if (event_is_scaled(evt))
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            double scaled = (*result)[i].value * evt->scale;
+            memcpy(&((*result)[i].value), &scaled, sizeof(scaled));
+        }
+    }
+    if (tsc_enabled)
+    {
+        tsc_checkpoint(TSC_CALIBRATION_NS / 100);
+        tsc_to_wtime(*result, count);
+    }
+    return count;
+}
+
+static void reverse_samples(timevalue_t* samples, size_t count)
+{
+    for (size_t i = 0; i < count / 2; i++)
+    {
+        timevalue_t tmp = samples[i];
+        samples[i] = samples[count - 1 - i];
+        samples[count - 1 - i] = tmp;
+    }
+}
+
 uint64_t get_all_values(int32_t id, timevalue_t** result)
 {
-    event_list[id].enabled = 0;
+    if (drain_us > 0)
+    {
+        return drain_values(event_list[id], result);
+    }
+#ifdef BPF_SAMPLING
+    /* collect the readings still in the ring buffer before the counter is removed */
+    if (bpf_active && event_list[id]->type == EVENT_COUNTER)
+    {
+        bpf_drain();
+        pthread_mutex_lock(&bpf_lock);
+        bpf_sampling_remove(event_list[id]);
+        pthread_mutex_unlock(&bpf_lock);
+    }
+#endif
+    __atomic_store_n(&(event_list[id]->enabled), 0, __ATOMIC_SEQ_CST);
+
+    if (event_list[id]->type == EVENT_SERVICE)
+    {
+        return get_service_values(event_list[id], result);
+    }
+
+    /* wait for the marks that are just being recorded */
+    if (event_list[id]->type == EVENT_MARKER)
+    {
+        while (__atomic_load_n(&marker_writers, __ATOMIC_SEQ_CST) > 0)
+        {
+            sched_yield();
+        }
+    }
+
+    /* this is the last call for the event, so its counter is released right away, the sampler
+     * might just be reading it */
+    if (event_list[id]->cpu >= 0)
+    {
+        pthread_mutex_lock(&(sampler_locks[event_list[id]->cpu]));
+        release_event(event_list[id]);
+        pthread_mutex_unlock(&(sampler_locks[event_list[id]->cpu]));
+    }
+
+    /* the ring of the flight recorder is handed over oldest sample first */
+    if (flight_recorder && event_list[id]->result_vector != NULL)
+    {
+        size_t capacity = buf_size / sizeof(timevalue_t);
+        if (event_list[id]->data_count > capacity)
+        {
+            timevalue_t* ring = event_list[id]->result_vector;
+            size_t oldest = event_list[id]->data_count % capacity;
+            reverse_samples(ring, oldest);
+            reverse_samples(ring + oldest, capacity - oldest);
+            reverse_samples(ring, capacity);
+            event_list[id]->data_count = capacity;
+        }
+    }
 
-    *result = event_list[id].result_vector;
+    /* converts the counts to doubles in one pass, instead of once per sample */
+    if (event_is_scaled(event_list[id]))
+    {
+        timevalue_t* values = event_list[id]->result_vector;
+        for (size_t i = 0; i < event_list[id]->data_count; i++)
+        {
+            double scaled = values[i].value * event_list[id]->scale;
+            memcpy(&(values[i].value), &scaled, sizeof(scaled));
+        }
+    }
+    /* the calibration at the end spans the whole run */
+    if (tsc_enabled && event_list[id]->result_vector != NULL)
+    {
+        tsc_checkpoint(TSC_CALIBRATION_NS / 100);
+        tsc_to_wtime(event_list[id]->result_vector, event_list[id]->data_count);
+    }
+    *result = event_list[id]->result_vector;
 
-    return event_list[id].data_count;
+    return event_list[id]->data_count;
 }
 #endif
 
+#ifndef BACKEND_RECORD
 #ifdef BACKEND_SCOREP
 SCOREP_METRIC_PLUGIN_ENTRY(upe_plugin)
 #endif
@@ -628,6 +3554,15 @@ vt_plugin_cntr_info get_info()
     info.run_per = SCOREP_METRIC_PER_HOST;
     info.sync = SCOREP_METRIC_ASYNC;
     info.delta_t = UINT64_MAX;
+    /* Score-P asks for the values at events, at most every delta_t ticks of its timer, which are
+     * nsecs or cycles of the tsc for the common timers */
+    char* env_string = getenv("UPE_DRAIN_US");
+    drain_us = env_string != NULL ? strtoull(env_string, NULL, 10) : 0;
+    if (drain_us > 0)
+    {
+        info.sync = SCOREP_METRIC_ASYNC_EVENT;
+        info.delta_t = drain_us * 1000;
+    }
     info.set_clock_function = set_pform_wtime_function;
 #endif
 #endif
@@ -649,3 +3584,4 @@ vt_plugin_cntr_info get_info()
     info.finalize = fini;
     return info;
 }
+#endif
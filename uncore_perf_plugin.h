@@ -34,7 +34,18 @@
 #include <stdint.h>
 #include <stdlib.h>
 
-#if !defined(BACKEND_SCOREP) && !defined(BACKEND_VTRACE)
+#include "mmio_wrapper.h"
+#include "upe_control.h"
+#include "upe_live.h"
+#include "upe_record.h"
+
+/* the standalone recorder brings its own types, independent of the plugin backend */
+#ifdef BACKEND_RECORD
+#undef BACKEND_SCOREP
+#undef BACKEND_VTRACE
+#endif
+
+#if !defined(BACKEND_SCOREP) && !defined(BACKEND_VTRACE) && !defined(BACKEND_RECORD)
 #define BACKEND_VTRACE
 #endif
 
@@ -42,6 +53,30 @@
 #error "Cannot compile for both VT and Score-P at the same time!\n"
 #endif
 
+/* x86_adapt and the msr backend share the uncore box handling of x86a_wrapper.c */
+#if defined(X86_ADAPT) && defined(MSR_DIRECT)
+#error "Cannot use x86_adapt and the msr backend at the same time!\n"
+#endif
+
+#if defined(X86_ADAPT) || defined(MSR_DIRECT)
+#define UNCORE_BOXES
+#endif
+
+#if defined(BPF_SAMPLING) && (defined(UNCORE_BOXES) || defined(METRIC_SYNC))
+#error "BPF sampling needs the perf backend in asynchronous mode\n"
+#endif
+
+/* without libpfm, perf events are only given perf-style, see perf_sysfs.h */
+#if defined(NO_LIBPFM) && defined(UNCORE_BOXES)
+#error "x86_adapt and the msr backend need libpfm to encode the events\n"
+#endif
+
+#if defined(NO_LIBPFM) && !defined(UNCORE_BOXES)
+#include <linux/perf_event.h>
+#elif !defined(UNCORE_BOXES)
+#include <perfmon/perf_event.h>
+#endif
+
 #ifdef BACKEND_SCOREP
 #include <scorep/SCOREP_MetricPlugins.h>
 #endif
@@ -49,7 +84,21 @@
 #include <vampirtrace/vt_plugin_cntr.h>
 #endif
 
-#define MAX_EVENTS 512
+/* pseudo event recording the interval and read cost of the samplers of each package */
+#define UPE_CALIBRATION_EVENT "upe:calibration"
+
+/* where the values of an event come from */
+enum event_type
+{
+    EVENT_COUNTER,   /* perf event or uncore box counter */
+    EVENT_MMIO,      /* memory mapped register, see mmio_wrapper.h */
+    EVENT_MUX_RATIO, /* share of time a perf event was scheduled, sampled with its counter */
+    EVENT_SERVICE,   /* samples taken by a node-local upe-record service, see UPE_SERVICE */
+    EVENT_SUMMARY,   /* window statistic of the rate of an event, see UPE_SUMMARY_US */
+    EVENT_MARKER,    /* marks recorded through upe_control(), see upe_control.h */
+    EVENT_INTERVAL,  /* sampling interval of a sampler in usecs, see UPE_OVERHEAD_BUDGET */
+    EVENT_READ_COST, /* time a sampler takes to read all its events once in nsecs */
+};
 
 #ifdef BACKEND_SCOREP
 typedef SCOREP_Metric_Plugin_MetricProperties metric_properties_t;
@@ -62,6 +111,21 @@ typedef vt_plugin_cntr_metric_info metric_properties_t;
 typedef vt_plugin_cntr_timevalue timevalue_t;
 typedef vt_plugin_cntr_info plugin_info_type;
 #endif
+
+#ifdef BACKEND_RECORD
+typedef struct
+{
+    char* name;
+    char* unit;
+    int32_t is_double; /* the values hold the bits of a double instead of an uint64_t */
+} metric_properties_t;
+typedef struct
+{
+    uint64_t timestamp;
+    uint64_t value;
+} timevalue_t;
+#endif
+
 struct event
 {
     int32_t node;
@@ -72,14 +136,78 @@ struct event
     size_t data_count;
     timevalue_t* result_vector;
     char* name;
+    char* fstr;       /* encoded event, the counter is opened by add_counter() */
+    int32_t acquired; /* counter and result_vector are set up */
     int32_t fd;
-#ifdef X86_ADAPT
+    enum event_type type;
+    uint64_t ctr_mask; /* counters narrower than 64 bit are extended on read */
+    uint64_t last;
+    double scale; /* sysfs scale of perf-style events, 0.0 if the counts are reported as is */
+    char* unit;   /* sysfs unit of perf-style events, see perf_sysfs.h */
+    struct mmio_counter mmio;
+    struct event_summary* summary; /* streaming statistics, if only summaries are recorded */
+    const struct upe_record* service; /* EVENT_SERVICE: file and index in the file */
+    int32_t service_event;
+    uint64_t service_begin; /* time of add_counter(), in the clock of the service */
+    uint64_t wtime_begin;
+    struct upe_live_event* live; /* entry in the live view, see UPE_LIVE */
+    uint64_t live_value;         /* sample the live rate is computed from */
+    uint64_t live_ns;
+    uint64_t adapt_value; /* previous sample and rate, see UPE_ADAPTIVE_US */
+    uint64_t adapt_timestamp;
+    double adapt_rate;
+    double adapt_change; /* relative change of the rate at the last sample */
+    uint32_t decimation; /* only every 2^decimation-th sample is stored, see UPE_DECIMATE */
+    uint32_t decimation_skipped;
+    double decimation_sum; /* of the skipped values of double events, which are averaged */
+    int32_t trigger; /* the rate of the event is checked against UPE_TRIGGER */
+    uint64_t trigger_value;
+    uint64_t trigger_ns;
+#ifdef UNCORE_BOXES
     int32_t item;
+    uint64_t codes[3];
+    int32_t codes_count;
+#else
+    struct perf_event_attr attr;
+    uint64_t time_enabled; /* perf multiplexing times of the previous read */
+    uint64_t time_running;
+    struct event* mux_ratio; /* optional EVENT_MUX_RATIO companion */
+    int32_t bpf_slot;        /* counters map slot, if sampled by BPF, see bpf_wrapper.h */
 #endif
 } __attribute__((aligned(64)));
 
-int32_t node_num;
-int32_t cpus;
+/* the values of the event hold the bits of a double */
+static inline int event_is_double(const struct event* evt)
+{
+    if (evt->type == EVENT_SERVICE)
+    {
+        return evt->service->events[evt->service_event].is_double;
+    }
+    return evt->type == EVENT_MUX_RATIO || evt->type == EVENT_SUMMARY;
+}
+
+extern int32_t node_num;
+extern int32_t cpus;
+
+/* Allocates the result buffer of an event, malloc() is used if none is set. The name and node of
+ * the event are valid when it is called. */
+typedef timevalue_t* (*buffer_allocator_t)(const struct event* evt, size_t size);
+void set_buffer_allocator(buffer_allocator_t allocator);
+
+/* If enabled, full result buffers wrap around instead of disabling their event. data_count then
+ * counts all samples ever taken, sample n is stored at index n % (buffer size / sample size).
+ * This takes precedence over UPE_DECIMATE. */
+void set_ring_buffers(int enabled);
+
+#ifdef BACKEND_RECORD
+/* entry points used by upe-record */
+void set_pform_wtime_function(uint64_t (*pform_wtime)(void));
+int32_t init(void);
+void fini(void);
+metric_properties_t* get_event_info(char* __event_name);
+int32_t add_counter(char* event_name);
+uint64_t get_all_values(int32_t id, timevalue_t** result);
+#endif
 
 #if 0
 int32_t init(void);
@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* upe-bench: measures how much the sampling threads slow an application down and whether the
+ * sampled counts match the traffic of the application. Kernels with a known memory traffic run
+ * without and with the events being sampled, at several intervals and numbers of events. Without
+ * events on the command line, the kernels count their own traffic in a file that is sampled as
+ * mmio event, so the benchmark also runs without access to the uncore counters. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uncore_perf_plugin.h"
+
+#ifdef METRIC_SYNC
+#error "upe-bench needs the asynchronous sampling threads, do not set METRIC_SYNC"
+#endif
+
+#define LINE_SIZE 64
+#define STREAM_PASSES 5
+#define IDLE_NS 200000000ull
+#define SYNTHETIC_EVENTS 64
+/* samples the kernels publish to the synthetic counter per run, so the sampled values increase
+ * steadily instead of jumping once per pass */
+#define SYNTHETIC_CHUNK 4096
+
+struct kernel
+{
+    const char* name;
+    uint64_t (*run)(void); /* returns the number of bytes that were moved */
+};
+
+static size_t size = 128 * 1024 * 1024;
+static double* stream_a;
+static double* stream_b;
+static double* stream_c;
+static size_t* chase;
+
+/* synthetic counter, NULL if hardware events are sampled */
+static volatile uint64_t* synthetic;
+static char synthetic_path[] = "/tmp/upe-bench.XXXXXX";
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_nsec + ts.tv_sec * 1000000000ull;
+}
+
+static inline void account(uint64_t bytes)
+{
+    if (synthetic != NULL)
+    {
+        __atomic_fetch_add(synthetic, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/* STREAM triad, every element reads b and c, allocates the line of a and writes it back */
+static uint64_t run_stream(void)
+{
+    size_t n = size / sizeof(double);
+    size_t chunk = (n + SYNTHETIC_CHUNK - 1) / SYNTHETIC_CHUNK;
+
+    for (int pass = 0; pass < STREAM_PASSES; pass++)
+    {
+        for (size_t begin = 0; begin < n; begin += chunk)
+        {
+            size_t end = begin + chunk < n ? begin + chunk : n;
+            for (size_t i = begin; i < end; i++)
+            {
+                stream_a[i] = stream_b[i] + 3.0 * stream_c[i];
+            }
+            account((end - begin) * 4 * sizeof(double));
+        }
+    }
+    return (uint64_t)STREAM_PASSES * n * 4 * sizeof(double);
+}
+
+/* walks a random cycle through all lines of a buffer much larger than the LLC, so every step
+ * misses */
+static uint64_t run_chase(void)
+{
+    size_t lines = size / LINE_SIZE;
+    size_t chunk = (lines + SYNTHETIC_CHUNK - 1) / SYNTHETIC_CHUNK;
+    size_t pos = 0;
+
+    for (size_t begin = 0; begin < lines; begin += chunk)
+    {
+        size_t end = begin + chunk < lines ? begin + chunk : lines;
+        for (size_t i = begin; i < end; i++)
+        {
+            pos = chase[pos];
+        }
+        account((end - begin) * LINE_SIZE);
+    }
+    /* keep the walk from being optimized away */
+    __asm__ volatile("" : : "r"(pos));
+    return (uint64_t)lines * LINE_SIZE;
+}
+
+static uint64_t run_idle(void)
+{
+    struct timespec ts = { IDLE_NS / 1000000000ull, IDLE_NS % 1000000000ull };
+    nanosleep(&ts, NULL);
+    return 0;
+}
+
+static const struct kernel kernels[] = {
+    { "idle", run_idle },
+    { "stream", run_stream },
+    { "chase", run_chase },
+};
+
+static int setup_kernels(void)
+{
+    size_t lines = size / LINE_SIZE;
+    size_t n = size / sizeof(double);
+
+    stream_a = malloc(size);
+    stream_b = malloc(size);
+    stream_c = malloc(size);
+    /* one index per line, each line is used as a node of the cycle */
+    chase = aligned_alloc(LINE_SIZE, lines * LINE_SIZE);
+    if (stream_a == NULL || stream_b == NULL || stream_c == NULL || chase == NULL)
+    {
+        fprintf(stderr, "Could not allocate the buffers of the kernels\n");
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        stream_a[i] = 0.0;
+        stream_b[i] = 1.0;
+        stream_c[i] = 2.0;
+    }
+
+    /* Sattolo's algorithm gives a single cycle through all lines */
+    size_t* order = malloc(lines * sizeof(size_t));
+    if (order == NULL)
+    {
+        fprintf(stderr, "Could not allocate the buffers of the kernels\n");
+        return -1;
+    }
+    for (size_t i = 0; i < lines; i++)
+    {
+        order[i] = i;
+    }
+    srand(1);
+    for (size_t i = lines - 1; i > 0; i--)
+    {
+        size_t j = (((size_t)rand() << 31) ^ rand()) % i;
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    size_t stride = LINE_SIZE / sizeof(size_t);
+    for (size_t i = 0; i < lines; i++)
+    {
+        chase[order[i] * stride] = order[(i + 1) % lines] * stride;
+    }
+    free(order);
+    return 0;
+}
+
+static int setup_synthetic(void)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    int fd = mkstemp(synthetic_path);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not create %s: %s\n", synthetic_path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, page_size))
+    {
+        fprintf(stderr, "Could not resize %s: %s\n", synthetic_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    synthetic = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (synthetic == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s: %s\n", synthetic_path, strerror(errno));
+        synthetic = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t median(uint64_t* values, int count)
+{
+    qsort(values, count, sizeof(uint64_t), compare_u64);
+    return values[count / 2];
+}
+
+static void sleep_us(uint64_t us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+/* parses a comma separated list of positive numbers */
+static int parse_list(const char* s, uint64_t* values, int max)
+{
+    int count = 0;
+    char* end;
+
+    while (*s != '\0' && count < max)
+    {
+        values[count] = strtoull(s, &end, 10);
+        if (end == s || values[count] == 0)
+        {
+            return -1;
+        }
+        count++;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+/* runs a kernel repeatedly and returns the median runtime in ns, the moved bytes are summed up */
+static uint64_t run_kernel(const struct kernel* kernel, int reps, uint64_t* bytes)
+{
+    uint64_t runtimes[reps];
+
+    *bytes = 0;
+    for (int i = 0; i < reps; i++)
+    {
+        uint64_t begin = monotonic_ns();
+        *bytes += kernel->run();
+        runtimes[i] = monotonic_ns() - begin;
+    }
+    return median(runtimes, reps);
+}
+
+/* Runs a kernel while the first event_count events are sampled. The first traffic_count events
+ * count the traffic of the kernel, their counts are summed up to *counted. Returns the median
+ * runtime in ns or 0 if the events could not be sampled. */
+static uint64_t run_sampled(const struct kernel* kernel, int reps, uint64_t interval_us,
+                            char** events, int event_count, int traffic_count,
+                            uint64_t bytes_per_count, uint64_t* expected, uint64_t* counted)
+{
+    char* names[UPE_RECORD_MAX_EVENTS];
+    int32_t ids[UPE_RECORD_MAX_EVENTS];
+    int32_t traffic[UPE_RECORD_MAX_EVENTS];
+    int names_size = 0;
+    uint64_t runtime = 0;
+    char interval[32];
+
+    snprintf(interval, sizeof(interval), "%" PRIu64, interval_us);
+    setenv("UPE_INTERVAL_US", interval, 1);
+    if (init())
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < event_count; i++)
+    {
+        metric_properties_t* props = get_event_info(events[i]);
+        if (props == NULL)
+        {
+            fprintf(stderr, "Could not add event %s\n", events[i]);
+            goto out;
+        }
+        for (int j = 0; props[j].name != NULL; j++)
+        {
+            if (names_size < UPE_RECORD_MAX_EVENTS)
+            {
+                traffic[names_size] = i < traffic_count && !props[j].is_double;
+                names[names_size++] = props[j].name;
+            }
+            else
+            {
+                free(props[j].name);
+            }
+        }
+        free(props);
+    }
+    for (int i = 0; i < names_size; i++)
+    {
+        ids[i] = add_counter(names[i]);
+        if (ids[i] < 0)
+        {
+            fprintf(stderr, "Could not start %s\n", names[i]);
+            for (int j = 0; j < i; j++)
+            {
+                timevalue_t* result;
+                get_all_values(ids[j], &result);
+                free(result);
+            }
+            goto out;
+        }
+    }
+
+    /* the samples before and after the kernel enclose all of its traffic */
+    sleep_us(2 * interval_us);
+    runtime = run_kernel(kernel, reps, expected);
+    sleep_us(2 * interval_us);
+
+    *counted = 0;
+    for (int i = 0; i < names_size; i++)
+    {
+        timevalue_t* result;
+        uint64_t count = get_all_values(ids[i], &result);
+        if (traffic[i] && count >= 2)
+        {
+            *counted += (result[count - 1].value - result[0].value) * bytes_per_count;
+        }
+        free(result);
+    }
+
+out:
+    for (int i = 0; i < names_size; i++)
+    {
+        free(names[i]);
+    }
+    fini();
+    return runtime;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-s MiB] [-r reps] [-i intervals] [-n counts] [-b bytes] [-x event]... "
+            "[event...]\n"
+            "  -s  size of each buffer of the kernels in MiB (default 128)\n"
+            "  -r  repetitions of each kernel, the median runtime is reported (default 5)\n"
+            "  -i  comma separated sampling intervals in usecs (default 100000,10000,1000)\n"
+            "  -n  comma separated numbers of sampled events (default 1,4,16)\n"
+            "  -b  bytes per count of the traffic events (default 64)\n"
+            "  -x  additional event that is sampled but not counted as traffic\n"
+            "  event  events counting the memory traffic of the kernels, e.g. the CAS counts of\n"
+            "         all memory channels. Without events, the kernels count their own traffic\n"
+            "         in a synthetic mmio counter.\n",
+            name);
+}
+
+int main(int argc, char** argv)
+{
+    char* events[UPE_RECORD_MAX_EVENTS];
+    char* extra[UPE_RECORD_MAX_EVENTS];
+    char synthetic_events[SYNTHETIC_EVENTS][sizeof(synthetic_path) + 32];
+    int event_count = 0, extra_count = 0, traffic_count;
+    uint64_t intervals[16] = { 100000, 10000, 1000 };
+    uint64_t counts[16] = { 1, 4, 16 };
+    int intervals_size = 3, counts_size = 3;
+    uint64_t bytes_per_count = LINE_SIZE;
+    int reps = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:i:n:b:x:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            size = strtoull(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'i':
+            intervals_size = parse_list(optarg, intervals, 16);
+            break;
+        case 'n':
+            counts_size = parse_list(optarg, counts, 16);
+            break;
+        case 'b':
+            bytes_per_count = strtoull(optarg, NULL, 10);
+            break;
+        case 'x':
+            if (extra_count < UPE_RECORD_MAX_EVENTS)
+                extra[extra_count++] = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (size < LINE_SIZE * 2 || reps <= 0 || intervals_size <= 0 || counts_size <= 0 ||
+        bytes_per_count == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    set_pform_wtime_function(monotonic_ns);
+    if (setup_kernels())
+    {
+        return 1;
+    }
+
+    if (optind < argc)
+    {
+        for (int i = optind; i < argc && event_count < UPE_RECORD_MAX_EVENTS; i++)
+        {
+            events[event_count++] = argv[i];
+        }
+        traffic_count = event_count;
+    }
+    else
+    {
+        /* the first synthetic counter holds the traffic in bytes, the others stay constant */
+        if (setup_synthetic())
+        {
+            return 1;
+        }
+        for (int i = 0; i < SYNTHETIC_EVENTS; i++)
+        {
+            snprintf(synthetic_events[i], sizeof(synthetic_events[i]), MMIO_PREFIX "%s@%d",
+                     synthetic_path, i * (int)sizeof(uint64_t));
+            events[event_count++] = synthetic_events[i];
+        }
+        traffic_count = 1;
+        bytes_per_count = 1;
+        extra_count = 0;
+        printf("# no events given, sampling the synthetic counters in %s\n", synthetic_path);
+    }
+    for (int i = 0; i < extra_count && traffic_count + i < UPE_RECORD_MAX_EVENTS; i++)
+    {
+        events[traffic_count + i] = extra[i];
+        event_count = traffic_count + i + 1;
+    }
+
+    printf("%-8s %11s %6s %11s %10s %13s %13s %9s\n", "kernel", "interval_us", "events",
+           "runtime_ms", "slowdown_%", "expected_MiB", "counted_MiB", "error_%");
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        uint64_t expected;
+        /* warm up caches, page tables and the clock frequency before the baseline */
+        kernels[k].run();
+        uint64_t baseline = run_kernel(&kernels[k], reps, &expected);
+
+        printf("%-8s %11s %6d %11.3f %10s %13.1f %13s %9s\n", kernels[k].name, "-", 0,
+               baseline / 1e6, "-", expected / 1048576.0, "-", "-");
+
+        for (int i = 0; i < intervals_size; i++)
+        {
+            for (int c = 0; c < counts_size; c++)
+            {
+                int count = counts[c] < (uint64_t)event_count ? (int)counts[c] : event_count;
+                int traffic = count < traffic_count ? count : traffic_count;
+                uint64_t counted = 0;
+                uint64_t runtime =
+                    run_sampled(&kernels[k], reps, intervals[i], events, count, traffic,
+                                bytes_per_count, &expected, &counted);
+                if (runtime == 0)
+                {
+                    return 1;
+                }
+
+                printf("%-8s %11" PRIu64 " %6d %11.3f %10.2f %13.1f %13.1f ", kernels[k].name,
+                       intervals[i], count, runtime / 1e6,
+                       100.0 * ((double)runtime - (double)baseline) / baseline,
+                       expected / 1048576.0, counted / 1048576.0);
+                if (expected > 0 && traffic == traffic_count)
+                    printf("%9.2f\n", 100.0 * ((double)counted - (double)expected) / expected);
+                else
+                    printf("%9s\n", "-");
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (synthetic != NULL)
+    {
+        unlink(synthetic_path);
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Timer program of the BPF sampling backend. It runs on the timer interrupt of a cpu clock perf
+ * event on each sampler cpu, reads the counters of that cpu and pushes the values into a ring
+ * buffer, which the plugin drains in bulk. Compiled with clang -target bpf, see CMakeLists.txt. */
+
+#include <linux/bpf.h>
+#include <linux/bpf_perf_event.h>
+#include <bpf/bpf_helpers.h>
+
+#include "upe_bpf.h"
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+    __uint(key_size, sizeof(__u32));
+    __uint(value_size, sizeof(__u32));
+    __uint(max_entries, UPE_BPF_MAX_SLOTS);
+} counters SEC(".maps");
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, UPE_BPF_MAX_CPUS); /* the number of cpus is set by the plugin */
+    __type(key, __u32);
+    __type(value, struct upe_bpf_cpu_slots);
+} cpu_slots SEC(".maps");
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct upe_bpf_errors);
+} errors SEC(".maps");
+
+/* the size is set by the plugin before loading */
+struct
+{
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 1 << 22);
+} records SEC(".maps");
+
+SEC("perf_event")
+int upe_sample(struct bpf_perf_event_data* ctx)
+{
+    __u32 cpu = bpf_get_smp_processor_id();
+    __u32 zero = 0;
+    struct upe_bpf_cpu_slots* slots = bpf_map_lookup_elem(&cpu_slots, &cpu);
+    struct upe_bpf_errors* lost = bpf_map_lookup_elem(&errors, &zero);
+    __u64 now = bpf_ktime_get_ns();
+
+    if (slots == NULL || lost == NULL)
+    {
+        return 0;
+    }
+    for (__u32 i = 0; i < UPE_BPF_MAX_SLOTS; i++)
+    {
+        struct bpf_perf_event_value value;
+        struct upe_bpf_record* record;
+
+        if (i >= slots->count)
+        {
+            break;
+        }
+        /* also fails for a slot that is just being removed */
+        if (bpf_perf_event_read_value(&counters, slots->slots[i], &value, sizeof(value)))
+        {
+            lost->read_failures++;
+            continue;
+        }
+        record = bpf_ringbuf_reserve(&records, sizeof(*record), 0);
+        if (record == NULL)
+        {
+            lost->ring_drops++;
+            continue;
+        }
+        record->timestamp = now;
+        record->value = value.counter;
+        record->time_enabled = value.enabled;
+        record->time_running = value.running;
+        record->slot = slots->slots[i];
+        record->reserved = 0;
+        /* the plugin drains the buffer on its own schedule, so it is not woken up */
+        bpf_ringbuf_submit(record, BPF_RB_NO_WAKEUP);
+    }
+    return 0;
+}
+
+/* bpf_perf_event_read_value() is only available to GPL compatible programs */
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/* Layout of the maps shared by the timer program upe_bpf.bpf.c and bpf_wrapper.c. Only kernel
+ * types are used, so both sides can include it. */
+
+#include <linux/types.h>
+
+#define UPE_BPF_MAX_SLOTS 512 /* perf events in the counters map */
+#define UPE_BPF_MAX_CPUS 4096  /* entries of cpu_slots, lowered to the cpus present on load */
+
+/* slots of the counters map read by the timer of one cpu, all uncore counters of a package count
+ * on the same cpu, so it may read every slot */
+struct upe_bpf_cpu_slots
+{
+    __u32 count;
+    __u32 slots[UPE_BPF_MAX_SLOTS];
+};
+
+/* readings the program lost, counted per cpu */
+struct upe_bpf_errors
+{
+    __u64 read_failures; /* bpf_perf_event_read_value() failed */
+    __u64 ring_drops;    /* the ring buffer was full */
+};
+
+/* one reading of a counter in the ring buffer */
+struct upe_bpf_record
+{
+    __u64 timestamp; /* CLOCK_MONOTONIC in nsecs */
+    __u64 value;
+    __u64 time_enabled;
+    __u64 time_running;
+    __u32 slot;
+    __u32 reserved;
+};
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/* Control of the sampling threads of a running upe_plugin or upe-record. Sampling can be paused
+ * and resumed, paused samplers sleep without waking up until they are resumed. A mark makes every
+ * sampler take an extra sample right away, e.g. at the boundary of a phase, and is recorded as a
+ * sample of the event upe:markers, holding the number of the mark.
+ *
+ * The plugin is loaded by the measurement system at runtime, so applications look the function
+ * up instead of linking against the plugin:
+ *
+ *     upe_control_t control = upe_control_lookup();
+ *     if (control != NULL)
+ *         control(UPE_CONTROL_START);
+ *
+ * The lookup functions need -ldl. */
+
+#include <dlfcn.h>
+#include <stddef.h>
+
+#define UPE_MARKER_EVENT "upe:markers"
+
+enum upe_control_command
+{
+    UPE_CONTROL_START, /* resume sampling */
+    UPE_CONTROL_STOP,  /* pause sampling */
+    UPE_CONTROL_MARK,  /* same as upe_mark() */
+    UPE_CONTROL_TRIGGER, /* freeze the window of the flight recorder, see UPE_FLIGHT_RECORDER */
+};
+
+/* returns 0 on success, -1 otherwise */
+int upe_control(enum upe_control_command command);
+
+/* Requests an immediate sample of all events and records a marker if upe:markers is recorded.
+ * The marker is stored without a lock, it only waits for marks other threads store at the same
+ * time. Then it rings a doorbell the samplers wait on, it never waits for the samplers or for the
+ * hand-over of the values. Returns 0 on success, -1 if the samplers are not running
+ * asynchronously. */
+int upe_mark(void);
+
+typedef int (*upe_control_t)(enum upe_control_command command);
+typedef int (*upe_mark_t)(void);
+
+/* Returns a function of the loaded plugin, or NULL if the plugin is not loaded. ISO C does not
+ * convert the object pointer of dlsym() to a function pointer, the lookups below go through a
+ * union instead. */
+static inline void* upe_lookup(const char* name)
+{
+    void* handle = dlopen("libupe_plugin.so", RTLD_LAZY | RTLD_NOLOAD);
+    void* function = NULL;
+
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+    function = dlsym(handle, name);
+    dlclose(handle);
+    return function;
+}
+
+static inline upe_control_t upe_control_lookup(void)
+{
+    union
+    {
+        void* object;
+        upe_control_t function;
+    } symbol;
+    symbol.object = upe_lookup("upe_control");
+    return symbol.function;
+}
+
+static inline upe_mark_t upe_mark_lookup(void)
+{
+    union
+    {
+        void* object;
+        upe_mark_t function;
+    } symbol;
+    symbol.object = upe_lookup("upe_mark");
+    return symbol.function;
+}
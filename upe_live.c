@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "upe_live.h"
+
+#define LIVE_SIZE                                                                                  \
+    (sizeof(struct upe_live_header) + UPE_LIVE_MAX_EVENTS * sizeof(struct upe_live_event) +        \
+     UPE_LIVE_MAX_SAMPLERS * sizeof(struct upe_live_sampler))
+
+static void __set_pointers(struct upe_live* live)
+{
+    live->header = live->map;
+    live->events = (struct upe_live_event*)(live->header + 1);
+    live->samplers = (struct upe_live_sampler*)(live->events + UPE_LIVE_MAX_EVENTS);
+}
+
+int upe_live_create(const char* path, uint32_t interval_us, struct upe_live* live)
+{
+    int fd;
+
+    memset(live, 0, sizeof(*live));
+    /* a new file, so running viewers of the old one are not confused */
+    unlink(path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, LIVE_SIZE))
+    {
+        fprintf(stderr, "Could not resize %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    live->map_size = LIVE_SIZE;
+    live->map = mmap(NULL, live->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (live->map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+        live->map = NULL;
+        return -1;
+    }
+    __set_pointers(live);
+    live->header->version = UPE_LIVE_VERSION;
+    live->header->pid = getpid();
+    live->header->interval_us = interval_us;
+    /* the magic is set last, readers check it */
+    __atomic_store_n(&(live->header->magic), UPE_LIVE_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int upe_live_open(const char* path, struct upe_live* live)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    memset(live, 0, sizeof(*live));
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) || (size_t)st.st_size < LIVE_SIZE)
+    {
+        fprintf(stderr, "%s is not an upe live file\n", path);
+        close(fd);
+        return -1;
+    }
+    live->map_size = LIVE_SIZE;
+    live->map = mmap(NULL, live->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (live->map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+        live->map = NULL;
+        return -1;
+    }
+    __set_pointers(live);
+    if (__atomic_load_n(&(live->header->magic), __ATOMIC_ACQUIRE) != UPE_LIVE_MAGIC ||
+        live->header->version != UPE_LIVE_VERSION)
+    {
+        fprintf(stderr, "%s is not an upe live file of version %d\n", path, UPE_LIVE_VERSION);
+        upe_live_close(live);
+        return -1;
+    }
+    return 0;
+}
+
+void upe_live_close(struct upe_live* live)
+{
+    if (live->map != NULL)
+    {
+        munmap(live->map, live->map_size);
+    }
+    memset(live, 0, sizeof(*live));
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Live view of a running plugin or upe-record, see UPE_LIVE.
+ *
+ * The file starts with a struct upe_live_header, followed by UPE_LIVE_MAX_EVENTS entries of
+ * struct upe_live_event and UPE_LIVE_MAX_SAMPLERS entries of struct upe_live_sampler. Each
+ * entry holds the latest state of an event or sampler and is protected by a sequence lock: seq is
+ * odd while the entry is written. Readers map the file read only and copy an entry with
+ * upe_live_read(). Times are in ns of CLOCK_MONOTONIC. All fields are in host byte order. */
+#define UPE_LIVE_MAGIC 0x314556494c455055ull /* "UPELIVE1" */
+#define UPE_LIVE_VERSION 1
+#define UPE_LIVE_MAX_EVENTS 512
+#define UPE_LIVE_MAX_SAMPLERS 1024
+#define UPE_LIVE_NAME_LEN 192
+
+struct upe_live_header
+{
+    uint64_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t interval_us;
+    uint32_t event_count; /* entries in use, set once an entry is complete */
+    uint32_t sampler_count;
+    uint32_t reserved;
+};
+
+struct upe_live_event
+{
+    uint32_t seq;
+    int32_t package;
+    int32_t cpu;      /* cpu of the sampler */
+    uint32_t active;  /* cleared when the event is stopped */
+    uint32_t is_double;
+    uint32_t reserved;
+    char name[UPE_LIVE_NAME_LEN];
+    uint64_t timestamp; /* of the latest sample */
+    uint64_t value;     /* latest value, bits of a double if is_double */
+    double rate;        /* per second between the two latest samples, 0 for doubles */
+    uint64_t samples;   /* number of samples */
+    uint64_t capacity;  /* samples that fit into the buffer of the event */
+};
+
+struct upe_live_sampler
+{
+    uint32_t seq;
+    int32_t cpu;
+    uint64_t ticks;
+    uint64_t last_tick; /* time of the latest tick */
+    uint64_t read_ns;   /* duration of the reads of the latest tick */
+    uint64_t max_read_ns;
+};
+
+struct upe_live
+{
+    struct upe_live_header* header;
+    struct upe_live_event* events;
+    struct upe_live_sampler* samplers;
+    void* map;
+    size_t map_size;
+};
+
+/* creates or replaces the file for writing */
+int upe_live_create(const char* path, uint32_t interval_us, struct upe_live* live);
+/* maps an existing file read only */
+int upe_live_open(const char* path, struct upe_live* live);
+void upe_live_close(struct upe_live* live);
+
+/* the writer side of the sequence lock, only one thread writes an entry */
+static inline void upe_live_write_begin(uint32_t* seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void upe_live_write_end(uint32_t* seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/* a writer that died while updating an entry leaves its seq odd, readers give up after this */
+#define UPE_LIVE_READ_RETRIES 10000000
+
+/* Copies an entry of size bytes starting with its seq, retries while it is written. Returns 0, or
+ * -1 if the entry is still being written after UPE_LIVE_READ_RETRIES tries, the copy is stale
+ * then. */
+static inline int upe_live_read(const void* entry, void* copy, size_t size)
+{
+    const uint32_t* seq = entry;
+    uint32_t begin, end;
+    uint32_t tries = 0;
+
+    do
+    {
+        while ((begin = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+        {
+            if (++tries >= UPE_LIVE_READ_RETRIES)
+            {
+                memcpy(copy, entry, size);
+                return -1;
+            }
+        }
+        memcpy(copy, entry, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    } while (begin != end && ++tries < UPE_LIVE_READ_RETRIES);
+    return begin == end ? 0 : -1;
+}
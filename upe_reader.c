@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "upe_record.h"
+
+int upe_record_open(const char* path, struct upe_record* rec)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    memset(rec, 0, sizeof(*rec));
+    if (fd < 0)
+    {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) || st.st_size < 0 ||
+        (size_t)st.st_size < sizeof(struct upe_record_header) +
+                                 UPE_RECORD_MAX_EVENTS * sizeof(struct upe_record_event))
+    {
+        fprintf(stderr, "%s is not an upe record\n", path);
+        close(fd);
+        return -1;
+    }
+    rec->map_size = st.st_size;
+    rec->map = mmap(NULL, rec->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (rec->map == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+        rec->map = NULL;
+        return -1;
+    }
+
+    rec->header = rec->map;
+    rec->events = (const struct upe_record_event*)(rec->header + 1);
+    if (rec->header->magic != UPE_RECORD_MAGIC || rec->header->version != UPE_RECORD_VERSION ||
+        rec->header->event_count > UPE_RECORD_MAX_EVENTS)
+    {
+        fprintf(stderr, "%s is not an upe record of version %d\n", path, UPE_RECORD_VERSION);
+        upe_record_close(rec);
+        return -1;
+    }
+    return 0;
+}
+
+void upe_record_close(struct upe_record* rec)
+{
+    if (rec->map != NULL)
+    {
+        munmap(rec->map, rec->map_size);
+    }
+    memset(rec, 0, sizeof(*rec));
+}
+
+const struct upe_record_sample* upe_record_samples(const struct upe_record* rec, uint32_t event,
+                                                   uint64_t* head)
+{
+    const struct upe_record_event* evt;
+    uint64_t n;
+
+    *head = 0;
+    /* the recorder may still be adding events */
+    if (event >= __atomic_load_n(&(rec->header->event_count), __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    evt = &(rec->events[event]);
+    if (evt->offset >= rec->map_size || rec->header->capacity == 0 ||
+        rec->header->capacity > (rec->map_size - evt->offset) / sizeof(struct upe_record_sample))
+    {
+        return NULL;
+    }
+    /* the recorder may still be writing */
+    n = __atomic_load_n(&(evt->count), __ATOMIC_ACQUIRE);
+    if (!(rec->header->flags & UPE_RECORD_RING) && n > rec->header->capacity)
+    {
+        n = rec->header->capacity;
+    }
+    *head = n;
+    return (const struct upe_record_sample*)((const char*)rec->map + evt->offset);
+}
+
+int32_t upe_record_find(const struct upe_record* rec, const char* name)
+{
+    uint32_t event_count = __atomic_load_n(&(rec->header->event_count), __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < event_count; i++)
+    {
+        if (!strncmp(rec->events[i].name, name, UPE_RECORD_NAME_LEN))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int upe_record_write_csv(const struct upe_record* rec, FILE* out)
+{
+    for (uint32_t i = 0; i < rec->header->event_count; i++)
+    {
+        uint64_t head;
+        const struct upe_record_sample* samples = upe_record_samples(rec, i, &head);
+        uint64_t capacity = rec->header->capacity;
+        for (uint64_t j = head > capacity ? head - capacity : 0; j < head; j++)
+        {
+            const struct upe_record_sample* sample = &(samples[j % capacity]);
+            int ret;
+            if (rec->events[i].is_double)
+            {
+                double value;
+                memcpy(&value, &(sample->value), sizeof(value));
+                ret = fprintf(out, "%d,\"%s\",%" PRIu64 ",%g\n", rec->header->package,
+                              rec->events[i].name, sample->timestamp, value);
+            }
+            else
+            {
+                ret = fprintf(out, "%d,\"%s\",%" PRIu64 ",%" PRIu64 "\n", rec->header->package,
+                              rec->events[i].name, sample->timestamp, sample->value);
+            }
+            if (ret < 0)
+            {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* upe-record: samples uncore events without a Score-P or VampirTrace host, using the same event
+ * parsing and sampling threads as the plugin. The samples are written directly into memory
+ * mapped files, one per package, see upe_record.h. In service mode the files are ring buffers,
+ * which plugin instances on the same node read instead of programming the counters themselves. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uncore_perf_plugin.h"
+#include "upe_record.h"
+
+#ifdef METRIC_SYNC
+#error "upe-record needs the asynchronous sampling threads, do not set METRIC_SYNC"
+#endif
+
+#define HEADER_SIZE                                                                                \
+    (sizeof(struct upe_record_header) + UPE_RECORD_MAX_EVENTS * sizeof(struct upe_record_event))
+
+struct package_file
+{
+    int fd;
+    struct upe_record_header* header;
+    size_t header_size;
+    size_t region_size;
+};
+
+/* the buffer of an event and its entry in the file */
+struct recorded_event
+{
+    const struct event* evt;
+    struct upe_record_event* entry;
+};
+
+static const char* prefix = "upe";
+static int service = 0;
+static struct package_file* files;
+static struct recorded_event recorded[UPE_RECORD_MAX_EVENTS];
+static int32_t recorded_size = 0;
+static volatile sig_atomic_t stop = 0;
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_nsec + ts.tv_sec * 1000000000ull;
+}
+
+/* the sampling interval, as used by the plugin */
+static uint32_t get_interval_us(void)
+{
+    char* env_string = getenv("UPE_INTERVAL_US");
+    if (env_string == NULL || atoi(env_string) <= 0)
+    {
+        return 100000;
+    }
+    return atoi(env_string);
+}
+
+static size_t page_align(size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+static struct package_file* get_file(int32_t package, size_t size)
+{
+    struct package_file* file = &(files[package]);
+    char path[4096];
+
+    if (file->header != NULL)
+    {
+        return file;
+    }
+
+    snprintf(path, sizeof(path), "%s.%d.upe", prefix, package);
+    file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file->fd < 0)
+    {
+        fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    file->header_size = page_align(HEADER_SIZE);
+    file->region_size = page_align(size);
+    if (ftruncate(file->fd, file->header_size))
+    {
+        fprintf(stderr, "Could not resize %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    file->header =
+        mmap(NULL, file->header_size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (file->header == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+        file->header = NULL;
+        return NULL;
+    }
+
+    file->header->magic = UPE_RECORD_MAGIC;
+    file->header->version = UPE_RECORD_VERSION;
+    file->header->package = package;
+    file->header->capacity = size / sizeof(struct upe_record_sample);
+    file->header->flags = service ? UPE_RECORD_RING : 0;
+    file->header->interval_us = get_interval_us();
+    return file;
+}
+
+/* places the result buffer of an event in the file of its package */
+static timevalue_t* record_allocator(const struct event* evt, size_t size)
+{
+    struct package_file* file = get_file(evt->node, size);
+    struct upe_record_event* entry;
+    void* buffer;
+
+    if (file == NULL || recorded_size >= UPE_RECORD_MAX_EVENTS ||
+        file->header->event_count >= UPE_RECORD_MAX_EVENTS)
+    {
+        return NULL;
+    }
+
+    entry = (struct upe_record_event*)(file->header + 1) + file->header->event_count;
+    entry->offset = file->header_size + file->header->event_count * file->region_size;
+    if (ftruncate(file->fd, entry->offset + file->region_size))
+    {
+        fprintf(stderr, "Could not resize the file of package %d: %s\n", evt->node,
+                strerror(errno));
+        return NULL;
+    }
+    buffer = mmap(NULL, file->region_size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd,
+                  entry->offset);
+    if (buffer == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map the file of package %d: %s\n", evt->node,
+                strerror(errno));
+        return NULL;
+    }
+    snprintf(entry->name, sizeof(entry->name), "%s", evt->name);
+    entry->is_double = event_is_double(evt);
+    entry->count = 0;
+    __atomic_store_n(&(file->header->event_count), file->header->event_count + 1,
+                     __ATOMIC_RELEASE);
+
+    recorded[recorded_size].evt = evt;
+    recorded[recorded_size].entry = entry;
+    recorded_size++;
+    return buffer;
+}
+
+/* publishes the number of samples of each event, so the files can be read while recording */
+static void sync_counts(void)
+{
+    for (int32_t i = 0; i < recorded_size; i++)
+    {
+        uint64_t count = __atomic_load_n(&(recorded[i].evt->data_count), __ATOMIC_ACQUIRE);
+        __atomic_store_n(&(recorded[i].entry->count), count, __ATOMIC_RELEASE);
+    }
+}
+
+static void handle_signal(int sig)
+{
+    stop = 1;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-o prefix] [-i interval_us] [-d seconds] [-b] [-s] event...\n"
+            "  -o  prefix of the output files <prefix>.<package>.upe (default upe)\n"
+            "  -i  sampling interval in usecs (default UPE_INTERVAL_US or 100000)\n"
+            "  -d  stop after the given number of seconds (default until SIGINT/SIGTERM)\n"
+            "  -b  run in the background\n"
+            "  -s  service mode, keep the last samples in ring buffers for attached plugins\n",
+            name);
+}
+
+int main(int argc, char** argv)
+{
+    char* names[UPE_RECORD_MAX_EVENTS];
+    int32_t ids[UPE_RECORD_MAX_EVENTS];
+    int32_t names_size = 0;
+    int duration = 0, background = 0;
+    uint64_t sync_us = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:i:d:bsh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            prefix = optarg;
+            break;
+        case 'i':
+            setenv("UPE_INTERVAL_US", optarg, 1);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'b':
+            background = 1;
+            break;
+        case 's':
+            service = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* the sampling threads do not survive a fork, so detach before they are started */
+    if (background && daemon(1, 0))
+    {
+        fprintf(stderr, "Could not run in the background: %s\n", strerror(errno));
+        return 1;
+    }
+
+    set_pform_wtime_function(realtime_ns);
+    set_buffer_allocator(record_allocator);
+    set_ring_buffers(service);
+    if (init())
+    {
+        return 1;
+    }
+    files = calloc(node_num, sizeof(struct package_file));
+    if (files == NULL)
+    {
+        return 1;
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        metric_properties_t* props = get_event_info(argv[i]);
+        if (props == NULL)
+        {
+            fprintf(stderr, "Could not add event %s\n", argv[i]);
+            return 1;
+        }
+        for (int j = 0; props[j].name != NULL; j++)
+        {
+            if (names_size < UPE_RECORD_MAX_EVENTS)
+                names[names_size++] = props[j].name;
+            else
+                free(props[j].name);
+        }
+        free(props);
+    }
+    for (int i = 0; i < names_size; i++)
+    {
+        ids[i] = add_counter(names[i]);
+        if (ids[i] < 0)
+        {
+            fprintf(stderr, "Could not start %s\n", names[i]);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    /* attached plugins wait for the samples of their time window, so publish them every tick */
+    if (service)
+        sync_us = get_interval_us();
+    /* the control signals interrupt usleep(), so the duration is taken from the clock */
+    uint64_t end = realtime_ns() + duration * 1000000000ull;
+    while (!stop && (duration == 0 || realtime_ns() < end))
+    {
+        usleep(sync_us);
+        sync_counts();
+    }
+
+    /* get_all_values() stops the events, the remaining counts are published before the
+     * event list is released by fini() */
+    for (int i = 0; i < names_size; i++)
+    {
+        timevalue_t* result;
+        get_all_values(ids[i], &result);
+        free(names[i]);
+    }
+    sync_counts();
+    fini();
+
+    for (int i = 0; i < node_num; i++)
+    {
+        if (files[i].header != NULL)
+        {
+            munmap(files[i].header, files[i].header_size);
+            close(files[i].fd);
+        }
+    }
+    free(files);
+    return 0;
+}
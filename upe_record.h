@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Binary time series files written by upe-record, one file per package.
+ *
+ * A file starts with a struct upe_record_header, followed by UPE_RECORD_MAX_EVENTS entries of
+ * struct upe_record_event. The samples of each event are stored as pairs of uint64_t
+ * (timestamp in ns since the epoch, value) at the page aligned offset given in its entry. The
+ * sample counts are updated while recording, so a file can be read while it is written. If
+ * UPE_RECORD_RING is set, the samples of an event form a ring buffer: count is the number of
+ * samples ever written and sample n is stored at index n % capacity. All fields are in host
+ * byte order. */
+#define UPE_RECORD_MAGIC 0x3130434552455055ull /* "UPEREC01" */
+#define UPE_RECORD_VERSION 2
+#define UPE_RECORD_RING 0x1
+#define UPE_RECORD_MAX_EVENTS 512
+#define UPE_RECORD_NAME_LEN 232
+
+struct upe_record_header
+{
+    uint64_t magic;
+    uint32_t version;
+    int32_t package;
+    uint32_t interval_us;
+    uint32_t event_count;
+    uint64_t capacity; /* maximum number of samples per event */
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+struct upe_record_event
+{
+    char name[UPE_RECORD_NAME_LEN];
+    uint32_t is_double; /* the values hold the bits of a double */
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t offset;
+};
+
+struct upe_record_sample
+{
+    uint64_t timestamp;
+    uint64_t value;
+};
+
+/* a recorded file, mapped read only */
+struct upe_record
+{
+    const struct upe_record_header* header;
+    const struct upe_record_event* events;
+    void* map;
+    size_t map_size;
+};
+
+int upe_record_open(const char* path, struct upe_record* rec);
+void upe_record_close(struct upe_record* rec);
+
+/* Returns the sample buffer of the nth event and sets head to the number of samples written so
+ * far. Sample n is stored at index n % capacity, only the last capacity samples are valid. */
+const struct upe_record_sample* upe_record_samples(const struct upe_record* rec, uint32_t event,
+                                                   uint64_t* head);
+
+/* looks up an event by its name, returns -1 if it is not recorded in the file */
+int32_t upe_record_find(const struct upe_record* rec, const char* name);
+
+/* writes all samples of the file as csv lines "package,event,timestamp,value" */
+int upe_record_write_csv(const struct upe_record* rec, FILE* out);
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* upe-top: shows the live view of a running plugin or upe-record, see UPE_LIVE. The memory
+ * bandwidth, LLC and QPI/UPI rates of each package are summed up from the events with well known
+ * names, all events and samplers are listed below. */
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "upe_live.h"
+
+enum category
+{
+    CATEGORY_MEMORY, /* bytes, one cache line per count */
+    CATEGORY_LLC,
+    CATEGORY_LINK,
+    CATEGORY_NONE
+};
+
+/* the first matching pattern of a (lower case) event name decides its category */
+static const struct
+{
+    const char* pattern;
+    enum category category;
+} patterns[] = {
+    { "cas_count", CATEGORY_MEMORY }, { "llc_", CATEGORY_LLC },   { "_unc_c_", CATEGORY_LLC },
+    { "_unc_cha", CATEGORY_LLC },     { "_unc_q", CATEGORY_LINK }, { "_unc_upi", CATEGORY_LINK },
+};
+
+static enum category get_category(const char* name)
+{
+    char lower[UPE_LIVE_NAME_LEN];
+    int i;
+
+    for (i = 0; name[i] != '\0' && i < UPE_LIVE_NAME_LEN - 1; i++)
+    {
+        lower[i] = tolower((unsigned char)name[i]);
+    }
+    lower[i] = '\0';
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++)
+    {
+        if (strstr(lower, patterns[p].pattern) != NULL)
+        {
+            return patterns[p].category;
+        }
+    }
+    return CATEGORY_NONE;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_nsec + ts.tv_sec * 1000000000ull;
+}
+
+/* the events are named "Package: <n> Event: <event>" */
+static const char* short_name(const char* name)
+{
+    const char* event = strstr(name, "Event: ");
+    return event != NULL ? event + strlen("Event: ") : name;
+}
+
+static void show(const struct upe_live* live)
+{
+    uint32_t event_count = __atomic_load_n(&(live->header->event_count), __ATOMIC_ACQUIRE);
+    uint64_t now = monotonic_ns();
+    double sums[UPE_LIVE_MAX_SAMPLERS][CATEGORY_NONE] = { { 0 } };
+    int32_t packages = 0;
+
+    printf("pid %d, interval %u us, %u events\n\n", live->header->pid,
+           live->header->interval_us, event_count);
+    printf("%-60s %20s %14s %8s %6s\n", "event", "value", "rate/s", "age ms", "fill");
+    for (uint32_t i = 0; i < event_count; i++)
+    {
+        struct upe_live_event evt;
+        if (upe_live_read(&(live->events[i]), &evt, sizeof(evt)))
+        {
+            /* the writer stopped in the middle of an update, e.g. because it died */
+            evt.name[UPE_LIVE_NAME_LEN - 1] = '\0';
+            printf("P%-2d %-56.56s %20s\n", evt.package, short_name(evt.name), "stale");
+            continue;
+        }
+        if (!evt.active || evt.samples == 0)
+        {
+            continue;
+        }
+        if (evt.package >= 0 && evt.package < UPE_LIVE_MAX_SAMPLERS && !evt.is_double)
+        {
+            enum category category = get_category(evt.name);
+            if (category != CATEGORY_NONE)
+                sums[evt.package][category] += evt.rate;
+            if (evt.package >= packages)
+                packages = evt.package + 1;
+        }
+
+        printf("P%-2d %-56.56s ", evt.package, short_name(evt.name));
+        if (evt.is_double)
+        {
+            double value;
+            memcpy(&value, &(evt.value), sizeof(value));
+            printf("%20.6g %14s ", value, "-");
+        }
+        else
+        {
+            printf("%20" PRIu64 " %14.4g ", evt.value, evt.rate);
+        }
+        printf("%8.1f ", now > evt.timestamp ? (now - evt.timestamp) / 1e6 : 0.0);
+        if (evt.capacity > 0)
+            printf("%5.1f%%\n", 100.0 * evt.samples / evt.capacity);
+        else
+            printf("%6s\n", "ring");
+    }
+
+    printf("\n%-8s %14s %14s %14s\n", "package", "memory GB/s", "LLC Mevents/s",
+           "QPI/UPI Mev/s");
+    for (int32_t p = 0; p < packages; p++)
+    {
+        printf("%-8d %14.2f %14.2f %14.2f\n", p, sums[p][CATEGORY_MEMORY] * 64 / 1e9,
+               sums[p][CATEGORY_LLC] / 1e6, sums[p][CATEGORY_LINK] / 1e6);
+    }
+
+    printf("\n%-8s %12s %12s %12s %10s\n", "sampler", "ticks", "read us", "max read us",
+           "age ms");
+    for (uint32_t i = 0; i < live->header->sampler_count; i++)
+    {
+        struct upe_live_sampler sampler;
+        if (upe_live_read(&(live->samplers[i]), &sampler, sizeof(sampler)))
+        {
+            printf("cpu %-4d %12s\n", sampler.cpu, "stale");
+            continue;
+        }
+        if (sampler.ticks == 0)
+        {
+            continue;
+        }
+        printf("cpu %-4d %12" PRIu64 " %12.1f %12.1f %10.1f\n", sampler.cpu, sampler.ticks,
+               sampler.read_ns / 1e3, sampler.max_read_ns / 1e3,
+               now > sampler.last_tick ? (now - sampler.last_tick) / 1e6 : 0.0);
+    }
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-d seconds] [-1] <file>\n"
+            "  -d  delay between two updates (default 1)\n"
+            "  -1  print once and exit\n",
+            name);
+}
+
+int main(int argc, char** argv)
+{
+    struct upe_live live;
+    double delay = 1.0;
+    int once = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:1h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            delay = atof(optarg);
+            break;
+        case '1':
+            once = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || delay <= 0.0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (upe_live_open(argv[optind], &live))
+    {
+        return 1;
+    }
+
+    while (1)
+    {
+        if (!once)
+        {
+            /* clear the terminal */
+            printf("\033[H\033[2J");
+        }
+        show(&live);
+        fflush(stdout);
+        if (once)
+        {
+            break;
+        }
+        usleep(delay * 1e6);
+    }
+    upe_live_close(&live);
+    return 0;
+}
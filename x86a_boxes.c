@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2016, Technische Universität Dresden, Germany
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions
+ *    and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of
+ * conditions and the following disclaimer in the documentation and/or other materials provided with
+ * the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to
+ * endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+ * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "x86a_wrapper.h"
+
+/* Uncore box layouts per microarchitecture.
+ * The knob names are built as <prefix>[<nr>]_PMON_{STATUS,BOX_CTL,CTL<n>,CTR<n>,FIXED_CTL,FIXED_CTR}
+ * and <prefix>[<nr>]<filter suffix>, boxes that are not exported by x86_adapt are skipped.
+ * The msr backend uses the MSR layouts instead, the layout is given as
+ * { base, stride, count, ctrs, box_ctl, status, filter0, filter1, ctl0, ctr0, fixed_ctl, fixed_ctr,
+ *   offsets } */
+
+/* Counter constraints are taken from the uncore performance monitoring reference manuals, they
+ * are given as { event select, mask of usable counters } */
+
+/* Haswell-EP */
+static const struct unc_msr_layout hswep_ubox_msr = { 0x700, 0, 1, 2, -1, -1, -1, -1, 5, 9, 3, 4 };
+static const struct unc_msr_layout hswep_pcu_msr = { 0x710, 0, 1, 4, 0, 6, 5, -1, 1, 7, -1, -1 };
+static const struct unc_msr_layout hswep_sbox_msr = { 0x720, 0xa, 4, 4, 0, 5, -1, -1, 1, 6, -1, -1 };
+static const struct unc_msr_layout hswep_cbo_msr = { 0xe00, 0x10, 18, 4, 0, 7, 5, 6, 1, 8, -1, -1 };
+static const struct unc_constraint hswep_cbo_constraints[] = {
+    { 0x01, 0x1 }, { 0x09, 0x2 }, { 0x11, 0x1 }, { 0x36, 0x1 },
+    { 0x38, 0x3 }, { 0x3b, 0x1 }, { 0x3e, 0x1 }, { 0, 0 },
+};
+static const struct unc_constraint hswep_r2pcie_constraints[] = {
+    { 0x10, 0x3 }, { 0x11, 0x3 }, { 0x13, 0x1 }, { 0x23, 0x1 }, { 0x24, 0x1 }, { 0x25, 0x1 },
+    { 0x26, 0x3 }, { 0x27, 0x1 }, { 0x28, 0x3 }, { 0x29, 0x3 }, { 0x2a, 0x1 }, { 0x2b, 0x3 },
+    { 0x2c, 0x3 }, { 0x2d, 0x3 }, { 0x32, 0x3 }, { 0x33, 0x3 }, { 0x34, 0x3 }, { 0x35, 0x3 },
+    { 0, 0 },
+};
+static const struct unc_constraint hswep_r3qpi_constraints[] = {
+    { 0x01, 0x3 }, { 0x07, 0x7 }, { 0x08, 0x7 }, { 0x09, 0x7 }, { 0x0a, 0x7 }, { 0x0e, 0x7 },
+    { 0x10, 0x3 }, { 0x11, 0x3 }, { 0x12, 0x3 }, { 0x13, 0x1 }, { 0x14, 0x3 }, { 0x15, 0x3 },
+    { 0x1f, 0x3 }, { 0x20, 0x3 }, { 0x21, 0x3 }, { 0x22, 0x3 }, { 0x23, 0x3 }, { 0x25, 0x3 },
+    { 0x26, 0x3 }, { 0x28, 0x3 }, { 0x29, 0x3 }, { 0x2c, 0x3 }, { 0x2d, 0x3 }, { 0x2e, 0x3 },
+    { 0x2f, 0x3 }, { 0x31, 0x3 }, { 0x32, 0x3 }, { 0x33, 0x3 }, { 0x34, 0x3 }, { 0x36, 0x3 },
+    { 0x37, 0x3 }, { 0x38, 0x3 }, { 0x39, 0x3 }, { 0, 0 },
+};
+
+static const int32_t hswep_models[] = { 63, 0 };
+static const struct unc_box_desc hswep_boxes[] = {
+    { "unc_ubo", "U", 0, 0, UNC_CTR_SINGLE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER", NULL, 0, NULL,
+      &hswep_ubox_msr },
+    { "unc_pcu", "PCU", 0, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER", NULL, 1, NULL,
+      &hswep_pcu_msr },
+    { "unc_sbo", "S", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER0",
+      "_PMON_FILTER1", 1, NULL, &hswep_sbox_msr },
+    { "unc_cbo", "C", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER0",
+      "_PMON_FILTER1", 1, hswep_cbo_constraints, &hswep_cbo_msr },
+    { "unc_ha", "HA", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER0",
+      "_PMON_FILTER1", 1 },
+    /* libpfm enumerates the channels of both controllers 0-7,
+     * x86_adapt enumerates the channels per controller */
+    { "unc_imc", "IMC0_CHAN", 1, 0, UNC_CTR_SINGLE, UNC_CTR_MULTI, 48, "UNC_M_CLOCKTICKS",
+      "_PMON_FILTER0", "_PMON_FILTER1", 1 },
+    { "unc_imc", "IMC1_CHAN", 1, 4, UNC_CTR_SINGLE, UNC_CTR_MULTI, 48, "UNC_M_CLOCKTICKS",
+      "_PMON_FILTER0", "_PMON_FILTER1", 1 },
+    /* NOTE: not available in papi */
+    { NULL, "IRP", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER0", "_PMON_FILTER1",
+      1 },
+    { "unc_qpi", "QPI", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER0",
+      "_PMON_FILTER1", 1 },
+    { "unc_r2pcie", "R2PCIe", 0, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER", NULL,
+      1, hswep_r2pcie_constraints },
+    { "unc_r3qpi", "R3QPI0_Link_", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER0",
+      "_PMON_FILTER1", 1, hswep_r3qpi_constraints },
+};
+
+/* Broadwell-EP, Broadwell-DE, same layout as Haswell-EP */
+static const int32_t bdx_models[] = { 79, 86, 0 };
+
+/* Skylake-SP, Cascade Lake-SP, Cooper Lake-SP */
+static const int32_t skx_models[] = { 85, 0 };
+static const struct unc_msr_layout skx_cha_msr = { 0xe00, 0x10, 28, 4, 0, 7, 5, 6, 1, 8, -1, -1 };
+static const struct unc_msr_layout skx_iio_msr = { 0xa40, 0x20, 6, 4, 0, 7, -1, -1, 8, 1, -1, -1 };
+static const struct unc_msr_layout skx_irp_msr = { 0xa58, 0x20, 6, 2, 0, -1, -1, -1, 3, 1, -1, -1 };
+static const struct unc_constraint skx_cha_constraints[] = {
+    { 0x11, 0x1 },
+    { 0x36, 0x1 },
+    { 0, 0 },
+};
+static const struct unc_constraint skx_iio_constraints[] = {
+    { 0x83, 0x3 }, { 0x88, 0xc }, { 0x95, 0xc }, { 0xc0, 0xc }, { 0xc5, 0xc }, { 0xd4, 0xc },
+    { 0, 0 },
+};
+static const struct unc_constraint skx_m2pcie_constraints[] = {
+    { 0x23, 0x3 },
+    { 0, 0 },
+};
+static const struct unc_constraint skx_m3upi_constraints[] = {
+    { 0x1d, 0x1 }, { 0x1e, 0x1 }, { 0x40, 0x7 }, { 0x4e, 0x7 },
+    { 0x4f, 0x7 }, { 0x50, 0x7 }, { 0x51, 0x7 }, { 0x52, 0x7 },
+    { 0, 0 },
+};
+static const struct unc_box_desc skx_boxes[] = {
+    { "unc_ubo", "U", 0, 0, UNC_CTR_SINGLE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER", NULL, 0, NULL,
+      &hswep_ubox_msr },
+    { "unc_pcu", "PCU", 0, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER", NULL, 1, NULL,
+      &hswep_pcu_msr },
+    { "unc_cha", "CHA", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER0",
+      "_PMON_FILTER1", 1, skx_cha_constraints, &skx_cha_msr },
+    /* two controllers with three channels each, libpfm enumerates them 0-5 */
+    { "unc_imc", "IMC0_CHAN", 1, 0, UNC_CTR_SINGLE, UNC_CTR_MULTI, 48, "UNC_M_CLOCKTICKS", NULL,
+      NULL, 1 },
+    { "unc_imc", "IMC1_CHAN", 1, 3, UNC_CTR_SINGLE, UNC_CTR_MULTI, 48, "UNC_M_CLOCKTICKS", NULL,
+      NULL, 1 },
+    { "unc_m2m", "M2M", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1 },
+    { "unc_upi", "UPI", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1 },
+    { "unc_m3upi", "M3UPI", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1,
+      skx_m3upi_constraints },
+    { "unc_iio", "IIO", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1,
+      skx_iio_constraints, &skx_iio_msr },
+    { "unc_irp", "IRP", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1, NULL,
+      &skx_irp_msr },
+    { "unc_m2pcie", "M2PCIe", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1,
+      skx_m2pcie_constraints },
+};
+
+/* Ice Lake-SP, Ice Lake-D, the memory controllers are MMIO only and not covered here */
+static const int32_t icx_models[] = { 106, 108, 0 };
+/* the CHAs are not evenly spaced, there is a gap after CHA17 and CHA34 and up are placed below
+ * CHA0, the offsets are those of the Linux uncore driver */
+static const int32_t icx_cha_offsets[] = {
+    0x2a0, 0x2ae, 0x2bc, 0x2ca, 0x2d8, 0x2e6, 0x2f4, 0x302, 0x310, 0x31e,
+    0x32c, 0x33a, 0x348, 0x356, 0x364, 0x372, 0x380, 0x38e, 0x3aa, 0x3b8,
+    0x3c6, 0x3d4, 0x3e2, 0x3f0, 0x3fe, 0x40c, 0x41a, 0x428, 0x436, 0x444,
+    0x452, 0x460, 0x46e, 0x47c, 0x0,   0xe,   0x1c,  0x2a,  0x38,  0x46,
+};
+static const struct unc_msr_layout icx_cha_msr = { 0xb60, 0xe, 40, 4, 0, 7, 5, -1, 1, 8, -1, -1,
+                                                   icx_cha_offsets };
+static const struct unc_constraint icx_iio_constraints[] = {
+    { 0x02, 0x3 }, { 0x03, 0x3 }, { 0x83, 0x3 }, { 0x88, 0xc }, { 0xc0, 0xc }, { 0xc5, 0xc },
+    { 0xd5, 0xc }, { 0, 0 },
+};
+static const struct unc_constraint icx_m2pcie_constraints[] = {
+    { 0x14, 0x3 },
+    { 0x23, 0x3 },
+    { 0x2d, 0x3 },
+    { 0, 0 },
+};
+static const struct unc_constraint icx_m3upi_constraints[] = {
+    { 0x1c, 0x1 }, { 0x1d, 0x1 }, { 0x1e, 0x1 }, { 0x1f, 0x1 }, { 0x40, 0x7 },
+    { 0x4e, 0x7 }, { 0x4f, 0x7 }, { 0x50, 0x7 }, { 0x51, 0x7 }, { 0x52, 0x7 },
+    { 0, 0 },
+};
+static const struct unc_box_desc icx_boxes[] = {
+    { "unc_ubo", "U", 0, 0, UNC_CTR_SINGLE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 0, NULL,
+      &hswep_ubox_msr },
+    { "unc_pcu", "PCU", 0, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER", NULL, 1, NULL,
+      &hswep_pcu_msr },
+    { "unc_cha", "CHA", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, "_PMON_FILTER0", NULL, 1,
+      skx_cha_constraints, &icx_cha_msr },
+    { "unc_m2m", "M2M", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1 },
+    { "unc_upi", "UPI", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1 },
+    { "unc_m3upi", "M3UPI", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1,
+      icx_m3upi_constraints },
+    { "unc_iio", "IIO", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1,
+      icx_iio_constraints },
+    { "unc_irp", "IRP", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1 },
+    { "unc_m2pcie", "M2PCIe", 1, 0, UNC_CTR_NONE, UNC_CTR_MULTI, 48, NULL, NULL, NULL, 1,
+      icx_m2pcie_constraints },
+};
+
+#define boxes_of(boxes) boxes, (int32_t)(sizeof(boxes) / sizeof(boxes[0]))
+
+const struct unc_arch_desc unc_archs[] = {
+    { "hswep", hswep_models, "GLOBAL_PMON_BOX_CTL", "GLOBAL_PMON_STATUS", "GLOBAL_PMON_CONFIG",
+      (1ull << 31u), (1ull << 29u), 0x700, boxes_of(hswep_boxes) },
+    { "bdx", bdx_models, "GLOBAL_PMON_BOX_CTL", "GLOBAL_PMON_STATUS", "GLOBAL_PMON_CONFIG",
+      (1ull << 31u), (1ull << 29u), 0x700, boxes_of(hswep_boxes) },
+    /* no global freeze on these, the boxes are frozen one by one */
+    { "skx", skx_models, "GLOBAL_PMON_BOX_CTL", "GLOBAL_PMON_STATUS", "GLOBAL_PMON_CONFIG", 0, 0,
+      -1, boxes_of(skx_boxes) },
+    { "icx", icx_models, "GLOBAL_PMON_BOX_CTL", "GLOBAL_PMON_STATUS", "GLOBAL_PMON_CONFIG", 0, 0,
+      -1, boxes_of(icx_boxes) },
+};
+
+const int32_t unc_archs_size = sizeof(unc_archs) / sizeof(unc_archs[0]);
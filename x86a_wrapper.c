@@ -25,6 +25,7 @@
  * WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cpuid.h>
 #include <errno.h>
 #include <regex.h>
 #include <stdio.h>
@@ -32,22 +33,39 @@
 #include <string.h>
 
 #include "x86a_wrapper.h"
+#ifdef MSR_DIRECT
+#include "msr_wrapper.h"
+#else
 #include <x86_adapt.h>
+#endif
 
 static int32_t initialized = 0;
 
-regex_t cbo_regex, ha_regex, imc_regex, qpi_regex, r3qpi_regex, sbo_regex;
+static int32_t global_ctl;
+static int32_t global_status;
+static int32_t global_config;
 
-#define comp_boxreg(box)                                                                           \
-    do                                                                                             \
-    {                                                                                              \
-        int32_t ret = regcomp(&box##_regex, "unc_" #box "([[:digit:]]+)", REG_EXTENDED);           \
-        if (ret)                                                                                   \
-        {                                                                                          \
-            fprintf(stderr, "failed to compile regex for box " #box);                              \
-            return ret;                                                                            \
-        }                                                                                          \
-    } while (0)
+static const struct unc_arch_desc* arch;
+static struct unc_box_type* box_types;
+
+/* counter requested by an event, the counters are assigned per box by __schedule_box() and
+ * programmed by x86a_program_counters() */
+struct unc_request
+{
+    struct event* evt;
+    struct unc_box* box;
+    char* name;
+    uint64_t code;
+    uint64_t filter0;
+    uint64_t filter1;
+    uint32_t ctr_mask; /* counters the event may be counted on */
+    int32_t fixed;
+    int32_t ctr; /* assigned counter, -1 if the event could not be scheduled */
+};
+
+static struct unc_request* requests;
+static int32_t requests_size;
+static int32_t programmed = 0;
 
 #define check_ptr(ptr)                                                                             \
     do                                                                                             \
@@ -69,18 +87,53 @@ regex_t cbo_regex, ha_regex, imc_regex, qpi_regex, r3qpi_regex, sbo_regex;
         }                                                                                          \
     } while (0)
 
+/* register access of the backend, either x86_adapt or /dev/cpu/<cpu>/msr */
 static inline int32_t __lookup(const char* name)
 {
+#ifdef MSR_DIRECT
+    return -1;
+#else
     return x86_adapt_lookup_ci_name(X86_ADAPT_DIE, name);
+#endif
+}
+
+static inline int32_t __get_device(int32_t node)
+{
+#ifdef MSR_DIRECT
+    return msr_get_device(node);
+#else
+    return x86_adapt_get_device(X86_ADAPT_DIE, node);
+#endif
+}
+
+static inline void __put_device(int32_t node)
+{
+#ifndef MSR_DIRECT
+    x86_adapt_put_device(X86_ADAPT_DIE, node);
+#endif
+}
+
+static inline int32_t __get_setting(int32_t fd, int32_t reg, uint64_t* data)
+{
+#ifdef MSR_DIRECT
+    return msr_get_setting(fd, reg, data);
+#else
+    return x86_adapt_get_setting(fd, reg, data);
+#endif
+}
+
+static inline int32_t __set_setting(int32_t fd, int32_t reg, uint64_t data)
+{
+#ifdef MSR_DIRECT
+    return msr_set_setting(fd, reg, data);
+#else
+    return x86_adapt_set_setting(fd, reg, data);
+#endif
 }
 
 #define __FIXED 0
 #define __NORM 1
 
-#define __NONE 0
-#define __SINGLE 1
-#define __MULTI 2
-
 static inline void __lookup_single(struct unc_box* box, int32_t type, char* ctl, char* ctr)
 {
     struct unc_pair* pair = NULL;
@@ -168,95 +221,241 @@ static inline void __duplicate_box(struct unc_box** _box, int32_t size)
     *_box = box;
 }
 
-static inline void __single_box(struct unc_box** _box, int32_t* box_size, char* box_prefix,
-                                int32_t fixed_type, int32_t norm_type)
+/* name of the box with the given number, numbered boxes are <prefix><nr>, single boxes <prefix> */
+static inline void __box_name(char* buf, const struct unc_box_desc* desc, int32_t nr,
+                              const char* suffix)
 {
+    if (desc->multi)
+        sprintf(buf, "%s%d%s", desc->prefix, nr, suffix);
+    else
+        sprintf(buf, "%s%s", desc->prefix, suffix);
+}
+
+static inline void __lookup_counters(struct unc_box* box, const struct unc_box_desc* desc,
+                                     int32_t nr, int32_t type, int32_t layout)
+{
+    char ctl[64], ctr[64];
+    __box_name(ctl, desc, nr, type == __FIXED ? "_PMON_FIXED_CTL" : "_PMON_CTL");
+    __box_name(ctr, desc, nr, type == __FIXED ? "_PMON_FIXED_CTR" : "_PMON_CTR");
+    if (layout == UNC_CTR_SINGLE)
+        __lookup_single(box, type, ctl, ctr);
+    if (layout == UNC_CTR_MULTI)
+        __lookup_multi(box, type, ctl, ctr);
+}
+
+#ifdef MSR_DIRECT
+static inline int32_t __msr_reg(int32_t base, int32_t offset)
+{
+    return offset < 0 ? -1 : base + offset;
+}
+
+/* the boxes are taken from the MSR layout of the box, non existing boxes can not be read */
+static inline void __init_box_type(struct unc_box_type* type, const struct unc_box_desc* desc)
+{
+    const struct unc_msr_layout* msr = desc->msr;
     struct unc_box* box = NULL;
-    char ci_name[64], ctl[64], ctr[64];
-    sprintf(ci_name, "%s%s", box_prefix, "_PMON_STATUS");
-    *box_size = 0;
-    if (__lookup(ci_name) > 0)
+    int32_t fd = __get_device(0);
+    int32_t i = 0;
+    uint64_t data;
+
+    type->desc = desc;
+    type->box = NULL;
+    type->size = 0;
+    if (msr == NULL)
+        return;
+
+    for (i = 0; i < msr->count; i++)
     {
-        box = malloc(sizeof(struct unc_box));
+        int32_t base = msr->base + (msr->offsets != NULL ? msr->offsets[i] : i * msr->stride);
+        if (__get_setting(fd, base + msr->ctr0, &data) != 8)
+            break;
+
+        box = realloc(box, (i + 1) * sizeof(struct unc_box));
         check_ptr(box);
-        box->status = __lookup(ci_name);
-        sprintf(ci_name, "%s%s", box_prefix, "_PMON_BOX_CTL");
-        box->ctl = __lookup(ci_name);
-        sprintf(ci_name, "%s%s", box_prefix, "_PMON_FILTER");
-        box->filter0 = __lookup(ci_name);
-        box->filter1 = box->fixed_size = 0;
-        box->norm_size = 0;
-        sprintf(ctl, "%s%s", box_prefix, "_PMON_FIXED_CTL");
-        sprintf(ctr, "%s%s", box_prefix, "_PMON_FIXED_CTR");
-        if (fixed_type == __SINGLE)
-            __lookup_single(box, __FIXED, ctl, ctr);
-        if (fixed_type == __MULTI)
-            __lookup_multi(box, __FIXED, ctl, ctr);
-
-        sprintf(ctl, "%s%s", box_prefix, "_PMON_CTL");
-        sprintf(ctr, "%s%s", box_prefix, "_PMON_CTR");
-        if (norm_type == __SINGLE)
-            __lookup_single(box, __NORM, ctl, ctr);
-        if (norm_type == __MULTI)
-            __lookup_multi(box, __NORM, ctl, ctr);
-        *box_size = 1;
-        *_box = box;
-        __duplicate_box(_box, *box_size);
-    }
-}
-
-static inline void __multi_box(struct unc_box** _box, int32_t* box_size, char* box_prefix,
-                               int32_t fixed_type, int32_t norm_type)
+        box[i].status = __msr_reg(base, msr->status);
+        box[i].ctl = __msr_reg(base, msr->box_ctl);
+        box[i].filter0 = __msr_reg(base, msr->filter0);
+        box[i].filter1 = __msr_reg(base, msr->filter1);
+        box[i].filter0_val = box[i].filter1_val = 0;
+        box[i].fixed_size = msr->fixed_ctr < 0 ? 0 : 1;
+        box[i].norm_size = msr->ctrs;
+        box[i].fixed = NULL;
+        if (box[i].fixed_size > 0)
+        {
+            box[i].fixed = malloc(sizeof(struct unc_pair));
+            check_ptr(box[i].fixed);
+            box[i].fixed->used = 0;
+            box[i].fixed->ctl = __msr_reg(base, msr->fixed_ctl);
+            box[i].fixed->ctr = __msr_reg(base, msr->fixed_ctr);
+        }
+        box[i].norm = malloc(msr->ctrs * sizeof(struct unc_pair));
+        check_ptr(box[i].norm);
+        for (int32_t j = 0; j < msr->ctrs; j++)
+        {
+            box[i].norm[j].used = 0;
+            box[i].norm[j].ctl = base + msr->ctl0 + j;
+            box[i].norm[j].ctr = base + msr->ctr0 + j;
+        }
+
+        /* a single box has no successors */
+        if (!desc->multi)
+        {
+            i++;
+            break;
+        }
+    }
+    type->box = box;
+    type->size = i;
+    if (type->size > 0)
+        __duplicate_box(&(type->box), type->size);
+}
+#else
+static inline void __init_box_type(struct unc_box_type* type, const struct unc_box_desc* desc)
 {
     int32_t i = 0;
     struct unc_box* box = NULL;
-    char ci_name[64], ctl[64], ctr[64];
-    sprintf(ci_name, "%s%d%s", box_prefix, i, "_PMON_STATUS");
+    char ci_name[64];
+
+    type->desc = desc;
+    __box_name(ci_name, desc, i, "_PMON_STATUS");
     while (__lookup(ci_name) > 0)
     {
         box = realloc(box, (i + 1) * sizeof(struct unc_box));
         check_ptr(box);
 
         box[i].status = __lookup(ci_name);
-        sprintf(ci_name, "%s%d%s", box_prefix, i, "_PMON_BOX_CTL");
+        __box_name(ci_name, desc, i, "_PMON_BOX_CTL");
         box[i].ctl = __lookup(ci_name);
-        sprintf(ci_name, "%s%d%s", box_prefix, i, "_PMON_FILTER0");
-        box[i].filter0 = __lookup(ci_name);
-        sprintf(ci_name, "%s%d%s", box_prefix, i, "_PMON_FILTER1");
-        box[i].filter1 = __lookup(ci_name);
+        box[i].filter0 = box[i].filter1 = 0;
+        if (desc->filter0 != NULL)
+        {
+            __box_name(ci_name, desc, i, desc->filter0);
+            box[i].filter0 = __lookup(ci_name);
+        }
+        if (desc->filter1 != NULL)
+        {
+            __box_name(ci_name, desc, i, desc->filter1);
+            box[i].filter1 = __lookup(ci_name);
+        }
         box[i].fixed_size = 0;
         box[i].norm_size = 0;
-        sprintf(ctl, "%s%d%s", box_prefix, i, "_PMON_FIXED_CTL");
-        sprintf(ctr, "%s%d%s", box_prefix, i, "_PMON_FIXED_CTR");
-        if (fixed_type == __SINGLE)
-            __lookup_single(&(box[i]), __FIXED, ctl, ctr);
-        if (fixed_type == __MULTI)
-            __lookup_multi(&(box[i]), __FIXED, ctl, ctr);
-
-        sprintf(ctl, "%s%d%s", box_prefix, i, "_PMON_CTL");
-        sprintf(ctr, "%s%d%s", box_prefix, i, "_PMON_CTR");
-        if (norm_type == __SINGLE)
-            __lookup_single(&(box[i]), __NORM, ctl, ctr);
-        if (norm_type == __MULTI)
-            __lookup_multi(&(box[i]), __NORM, ctl, ctr);
+        box[i].filter0_val = box[i].filter1_val = 0;
+        __lookup_counters(&(box[i]), desc, i, __FIXED, desc->fixed_type);
+        __lookup_counters(&(box[i]), desc, i, __NORM, desc->norm_type);
 
         i++;
-        sprintf(ci_name, "%s%d%s", box_prefix, i, "_PMON_STATUS");
+        /* a single box has no successors */
+        if (!desc->multi)
+            break;
+        __box_name(ci_name, desc, i, "_PMON_STATUS");
     }
-    *_box = box;
-    *box_size = i;
-    __duplicate_box(_box, *box_size);
+    type->box = box;
+    type->size = i;
+    if (type->size > 0)
+        __duplicate_box(&(type->box), type->size);
 }
+#endif
 
-#define __reset_box(box)                                                                           \
-    do                                                                                             \
-    {                                                                                              \
-        for (int32_t i = 0; i < box##_size; i++)                                                   \
-        {                                                                                          \
-            ret = x86_adapt_set_setting(node, box[i].ctl, 0x3);                                    \
-            check_return(ret, "Failed to reset " #box "\n");                                       \
-        }                                                                                          \
-    } while (0)
+/* CPUID model of the family 6 processor we are running on, -1 for other processors */
+static int32_t __cpu_model(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return -1;
+    if (((eax >> 8u) & 0xfu) != 6)
+        return -1;
+    return ((eax >> 4u) & 0xfu) | ((eax >> 12u) & 0xf0u);
+}
+
+/* the uncore layout can be enforced by UPE_X86A_ARCH, otherwise it is selected by CPUID model */
+static const struct unc_arch_desc* __select_arch(void)
+{
+    char* env_string = getenv("UPE_X86A_ARCH");
+    int32_t model;
+
+    if (env_string != NULL)
+    {
+        for (int32_t i = 0; i < unc_archs_size; i++)
+        {
+            if (!strcmp(env_string, unc_archs[i].name))
+                return &(unc_archs[i]);
+        }
+        fprintf(stderr, "Unknown uncore layout %s given in UPE_X86A_ARCH\n", env_string);
+        return NULL;
+    }
+
+    model = __cpu_model();
+    for (int32_t i = 0; i < unc_archs_size; i++)
+    {
+        for (const int32_t* m = unc_archs[i].models; *m != 0; m++)
+        {
+            if (*m == model)
+                return &(unc_archs[i]);
+        }
+    }
+    fprintf(stderr, "No uncore layout known for cpu model %d\n", model);
+    return NULL;
+}
+
+static int32_t __check_write(int32_t ret, const char* what)
+{
+    if (ret == 8)
+    {
+        return 0;
+    }
+    fprintf(stderr, "Failed to %s\n", what);
+    if (ret == -1)
+    {
+        fprintf(stderr, "Error was: %s(%d)\n", strerror(errno), errno);
+        return errno;
+    }
+    else if (ret < 0)
+    {
+        fprintf(stderr, "Error was: %s(%d)\n", strerror(-ret), ret);
+        return -ret;
+    }
+    else
+    {
+        fprintf(stderr, "unexpected nr of bytes written: %d\n", ret);
+        return ret;
+    }
+}
+
+#define __ALL_BOXES 0
+#define __RESET_BOXES 1
+#define __USED_BOXES 2
+
+static inline int32_t __box_used(struct unc_box* box)
+{
+    for (int32_t i = 0; i < box->fixed_size; i++)
+        if (box->fixed[i].used)
+            return 1;
+    for (int32_t i = 0; i < box->norm_size; i++)
+        if (box->norm[i].used)
+            return 1;
+    return 0;
+}
+
+/* write the given value to the box control register of the selected boxes of a node */
+static int32_t __write_box_ctl(int32_t fd, int32_t node, uint64_t value, int32_t which)
+{
+    int32_t ret;
+    for (int32_t t = 0; t < arch->boxes_size; t++)
+    {
+        struct unc_box_type* type = &(box_types[t]);
+        if (which == __RESET_BOXES && !type->desc->reset)
+            continue;
+        for (int32_t i = 0; i < type->size; i++)
+        {
+            struct unc_box* box = &(type->box[i + node * type->size]);
+            if (box->ctl <= 0 || (which == __USED_BOXES && !__box_used(box)))
+                continue;
+            ret = __set_setting(fd, box->ctl, value);
+            check_return(ret, "Failed to write box control register\n");
+        }
+    }
+    return 0;
+}
 
 int32_t x86a_wrapper_init(void)
 {
@@ -266,100 +465,79 @@ int32_t x86a_wrapper_init(void)
         return 0;
     }
 
+    arch = __select_arch();
+    if (arch == NULL)
+    {
+        return -1;
+    }
+
+#ifdef MSR_DIRECT
+    if (msr_wrapper_init())
+    {
+        fprintf(stderr, "Could not open the msr devices\n");
+        return -1;
+    }
+#else
     if (x86_adapt_init())
     {
         fprintf(stderr, "Could not initialize x86_adapt library");
         return -1;
     }
+#endif
 
     /* buildup uncore box entries */
     /* global registers */
-    global_ctl = __lookup("GLOBAL_PMON_BOX_CTL");
-    global_status = __lookup("GLOBAL_PMON_STATUS");
-    global_config = __lookup("GLOBAL_PMON_CONFIG");
-
-    /* ubox */
-    __single_box(&ubox, &ubox_size, "U", __SINGLE, __MULTI);
-
-    /* pcubox */
-    __single_box(&pcubox, &pcubox_size, "PCU", __NONE, __MULTI);
-
-    /* sbox */
-    __multi_box(&sbox, &sbox_size, "S", __NONE, __MULTI);
-    comp_boxreg(sbo);
-
-    /* cbox */
-    __multi_box(&cbox, &cbox_size, "C", __NONE, __MULTI);
-    comp_boxreg(cbo);
-
-    /* habox */
-    __multi_box(&habox, &habox_size, "HA", __NONE, __MULTI);
-    comp_boxreg(ha);
-
-    /* imcbox */
-    __multi_box(&imc0box, &imc0box_size, "IMC0_CHAN", __SINGLE, __MULTI);
-    __multi_box(&imc1box, &imc1box_size, "IMC1_CHAN", __SINGLE, __MULTI);
-    comp_boxreg(imc);
-
-    /* irpbox */
-    // NOTE: not available in papi
-    __multi_box(&irpbox, &irpbox_size, "IRP", __NONE, __MULTI);
-    // comp_boxreg(irp);
-
-    /* qpibox */
-    __multi_box(&qpibox, &qpibox_size, "QPI", __NONE, __MULTI);
-    comp_boxreg(qpi);
-
-    /* r2pci */
-    __single_box(&r2pcibox, &r2pcibox_size, "R2PCIe", __NONE, __MULTI);
-
-    /* r3qpibox */
-    __multi_box(&r3qpibox, &r3qpibox_size, "R3QPI0_Link_", __NONE, __MULTI);
-    comp_boxreg(r3qpi);
+#ifdef MSR_DIRECT
+    global_ctl = arch->global_msr;
+    global_status = global_config = -1;
+#else
+    global_ctl = __lookup(arch->global_ctl);
+    global_status = __lookup(arch->global_status);
+    global_config = __lookup(arch->global_config);
+#endif
+
+    box_types = calloc(arch->boxes_size, sizeof(struct unc_box_type));
+    check_ptr(box_types);
+    for (int32_t t = 0; t < arch->boxes_size; t++)
+    {
+        const struct unc_box_desc* desc = &(arch->boxes[t]);
+        __init_box_type(&(box_types[t]), desc);
+        if (desc->multi && desc->pfm_name != NULL)
+        {
+            char pattern[64];
+            sprintf(pattern, "%s([[:digit:]]+)", desc->pfm_name);
+            ret = regcomp(&(box_types[t].regex), pattern, REG_EXTENDED);
+            if (ret)
+            {
+                fprintf(stderr, "failed to compile regex for box %s\n", desc->prefix);
+                return ret;
+            }
+        }
+    }
 
     for (int32_t i = 0; i < node_num; i++)
     {
-        int32_t node = x86_adapt_get_device(X86_ADAPT_DIE, i);
+        int32_t node = __get_device(i);
         if (node < 0)
         {
             fprintf(stderr, "Could not get fd on node %d for resetting the boxes\n", i);
             return -1;
         }
         /* freeze counter */
-        ret = x86_adapt_set_setting(node, global_ctl, (1u << 31u));
-        if (ret != 8)
+        ret = x86a_freeze(node, i);
+        if (ret)
         {
-            fprintf(stderr, "Failed to freeze counter\n");
-            if (ret == -1)
-            {
-                fprintf(stderr, "Error was: %s(%d)\n", strerror(errno), errno);
-                return errno;
-            }
-            else if (ret < 0)
-            {
-                fprintf(stderr, "Error was: %s(%d)\n", strerror(-ret), ret);
-                return -ret;
-            }
-            else
-            {
-                fprintf(stderr, "unexpected nr of bytes written: %d\n", ret);
-                return ret;
-            }
+            return ret;
         }
 
         /* reset boxes */
-        __reset_box(pcubox);
-        __reset_box(sbox);
-        __reset_box(cbox);
-        __reset_box(habox);
-        __reset_box(imc0box);
-        __reset_box(imc1box);
-        __reset_box(irpbox);
-        __reset_box(qpibox);
-        __reset_box(r2pcibox);
-        __reset_box(r3qpibox);
+        ret = __write_box_ctl(node, i, 0x3, __RESET_BOXES);
+        if (ret)
+        {
+            return ret;
+        }
 
-        x86_adapt_put_device(X86_ADAPT_DIE, i);
+        __put_device(i);
     }
 
     initialized = 1;
@@ -395,61 +573,62 @@ void x86a_wrapper_fini(void)
         return;
     }
 
-    __free_box(ubox, ubox_size);
-    __free_box(pcubox, pcubox_size);
-    __free_box(sbox, sbox_size);
-    __free_box(cbox, cbox_size);
-    __free_box(habox, habox_size);
-    __free_box(imc0box, imc0box_size);
-    __free_box(imc1box, imc1box_size);
-    __free_box(irpbox, irpbox_size);
-    __free_box(qpibox, qpibox_size);
-    __free_box(r2pcibox, r2pcibox_size);
-    __free_box(r3qpibox, r3qpibox_size);
-
-    regfree(&cbo_regex);
-    regfree(&ha_regex);
-    regfree(&imc_regex);
-    regfree(&qpi_regex);
-    regfree(&r3qpi_regex);
-    regfree(&sbo_regex);
+    for (int32_t t = 0; t < arch->boxes_size; t++)
+    {
+        __free_box(box_types[t].box, box_types[t].size);
+        if (box_types[t].desc->multi && box_types[t].desc->pfm_name != NULL)
+        {
+            regfree(&(box_types[t].regex));
+        }
+    }
+    free(box_types);
 
+    for (int32_t i = 0; i < requests_size; i++)
+    {
+        free(requests[i].name);
+    }
+    free(requests);
+    requests = NULL;
+    requests_size = 0;
+    programmed = 0;
+
+#ifdef MSR_DIRECT
+    msr_wrapper_fini();
+#else
     x86_adapt_finalize();
+#endif
     initialized = 0;
 }
 
 static inline int32_t __match_box(struct unc_box** ret_box, const char* pfm_name,
-                                  regex_t* box_regex, struct unc_box* box, int32_t size,
-                                  int32_t node)
+                                  struct unc_box_type* type, int32_t node)
 {
     int32_t ret;
     regmatch_t pmatch[2];
     char boxnum[8] = { 0 };
-    ret = regexec(box_regex, pfm_name, 2, pmatch, 0);
+
+    /* single boxes */
+    if (!type->desc->multi)
+    {
+        if (strstr(pfm_name, type->desc->pfm_name) == NULL)
+        {
+            return -1;
+        }
+        *ret_box = &(type->box[node]);
+        return 0;
+    }
+
+    /* multi boxes */
+    ret = regexec(&(type->regex), pfm_name, 2, pmatch, 0);
     if (!ret)
     {
         strncpy(boxnum, pfm_name + pmatch[1].rm_so, pmatch[1].rm_eo - pmatch[1].rm_so);
-        int32_t num = atoll(boxnum);
-        /* imcbox corner case handling
-         * papi enumerates the channel from both controllers 0-7
-         * but adapt enurate the channels for each controller */
-        if (strstr(pfm_name, "unc_imc") != NULL)
-        {
-            // if (box == NULL) {
-            if (num >= 0 && num < imc0box_size)
-            {
-                *ret_box = &(imc0box[num + node * size]);
-            }
-            else if (num >= 4 && num < (imc1box_size + 4))
-            {
-                *ret_box = &(imc1box[num - 4 + node * size]);
-            }
-            return 0;
-        }
-        /* default case */
-        else if (num >= 0 && num < size)
+        /* several kinds of boxes may share the libpfm name, e.g. the channels of the memory
+         * controllers, each one covers a range of box numbers */
+        int32_t num = atoll(boxnum) - type->desc->pfm_offset;
+        if (num >= 0 && num < type->size)
         {
-            *ret_box = &(box[num + node * size]);
+            *ret_box = &(type->box[num + node * type->size]);
             return 0;
         }
         else
@@ -460,77 +639,238 @@ static inline int32_t __match_box(struct unc_box** ret_box, const char* pfm_name
     return ret;
 }
 
-static int32_t __get_box(struct unc_box** box, const char* pfm_name, int32_t node)
+static int32_t __get_box(struct unc_box** box, struct unc_box_type** type, const char* pfm_name,
+                         int32_t node)
 {
     if (node >= node_num)
     {
         fprintf(stderr, "Node %d not available\n", node);
         return -1;
     }
-    /* single boxes */
-    /* ubox */
-    if (strstr(pfm_name, "unc_ubo") != NULL && ubox_size > 0)
+
+    for (int32_t t = 0; t < arch->boxes_size; t++)
     {
-        *box = &(ubox[node]);
-        return 0;
+        if (box_types[t].desc->pfm_name == NULL || box_types[t].size == 0)
+            continue;
+        if (!__match_box(box, pfm_name, &(box_types[t]), node))
+        {
+            *type = &(box_types[t]);
+            return 0;
+        }
     }
-    /* pcubox */
-    if (strstr(pfm_name, "unc_pcu") != NULL && pcubox_size > 0)
+
+    /* no box found */
+    return -1;
+}
+
+/* counters the event is restricted to */
+static uint32_t __ctr_mask(const struct unc_box_desc* desc, struct unc_box* box, uint64_t code)
+{
+    uint32_t mask = (1u << box->norm_size) - 1;
+    if (desc->constraints == NULL)
+        return mask;
+    for (const struct unc_constraint* c = desc->constraints; c->ctr_mask != 0; c++)
     {
-        *box = &(pcubox[node]);
-        return 0;
+        if (c->event == (code & 0xff))
+            return mask & c->ctr_mask;
     }
-    /* r2pcie */
-    if (strstr(pfm_name, "unc_r2pcie") != NULL && r2pcibox_size > 0)
+    return mask;
+}
+
+/* the filter registers are shared by all counters of a box, so all events have to agree on them */
+static inline int32_t __filter_compatible(uint64_t a, uint64_t b)
+{
+    return a == 0 || b == 0 || a == b;
+}
+
+/* augmenting path search of the bipartite matching between events and counters, a free counter
+ * is taken if there is one, so as few events as possible move */
+static int32_t __try_assign(int32_t* reqs, int32_t r, int32_t* owner, uint32_t* visited)
+{
+    for (int32_t c = 0; c < 32; c++)
     {
-        *box = &(r2pcibox[node]);
-        return 0;
+        if ((requests[reqs[r]].ctr_mask & (1u << c)) && owner[c] < 0)
+        {
+            owner[c] = r;
+            return 1;
+        }
+    }
+    for (int32_t c = 0; c < 32; c++)
+    {
+        if ((requests[reqs[r]].ctr_mask & (1u << c)) && !(*visited & (1u << c)))
+        {
+            *visited |= (1u << c);
+            if (owner[c] < 0 || __try_assign(reqs, owner[c], owner, visited))
+            {
+                owner[c] = r;
+                return 1;
+            }
+        }
     }
+    return 0;
+}
 
-    /* multi boxes */
-    /* cbox */
-    if (!__match_box(box, pfm_name, &cbo_regex, cbox, cbox_size, node))
-        return 0;
+/* Try to add the request to the events already scheduled on its box. The current assignment is
+ * extended by an augmenting path, so scheduled events may move to other counters to make room,
+ * e.g. for an event that can only be counted on the first counter. Returns 0 if the request was
+ * scheduled, the counters the other events moved away from are stored in old_ctr. */
+static int32_t __schedule_box(int32_t candidate, int32_t* reqs, int32_t* reqs_size,
+                              int32_t* old_ctr)
+{
+    struct unc_request* req = &(requests[candidate]);
+    struct unc_box* box = req->box;
+    int32_t owner[32];
+    int32_t r_candidate = -1;
+    uint32_t visited = 0;
+
+    if (!__filter_compatible(box->filter0_val, req->filter0) ||
+        !__filter_compatible(box->filter1_val, req->filter1))
+    {
+        fprintf(stderr, "Event %s conflicts with the filter settings of other events of its box\n",
+                req->name);
+        return -1;
+    }
 
-    /* habox */
-    if (!__match_box(box, pfm_name, &ha_regex, habox, habox_size, node))
-        return 0;
+    for (int32_t c = 0; c < 32; c++)
+        owner[c] = -1;
+    *reqs_size = 0;
+    for (int32_t i = 0; i < requests_size; i++)
+    {
+        if (requests[i].box != box || requests[i].fixed)
+            continue;
+        if (i == candidate)
+            r_candidate = *reqs_size;
+        else if (requests[i].ctr >= 0)
+            owner[requests[i].ctr] = *reqs_size;
+        else
+            continue;
+        old_ctr[*reqs_size] = requests[i].ctr;
+        reqs[(*reqs_size)++] = i;
+    }
 
-    /* imcbox */
-    /* corner case */
-    if (!__match_box(box, pfm_name, &imc_regex, NULL, imc0box_size, node))
-        return 0;
+    if (!__try_assign(reqs, r_candidate, owner, &visited))
+    {
+        fprintf(stderr, "No counter available for event %s\n", req->name);
+        return -1;
+    }
 
-    /* qpibox */
-    if (!__match_box(box, pfm_name, &qpi_regex, qpibox, qpibox_size, node))
-        return 0;
+    /* take over the new assignment */
+    for (int32_t c = 0; c < box->norm_size; c++)
+    {
+        box->norm[c].used = owner[c] >= 0;
+        if (owner[c] >= 0)
+            requests[reqs[owner[c]]].ctr = c;
+    }
+    box->filter0_val |= req->filter0;
+    box->filter1_val |= req->filter1;
+    return 0;
+}
 
-    /* r3qpibox */
-    if (!__match_box(box, pfm_name, &r3qpi_regex, r3qpibox, r3qpibox_size, node))
-        return 0;
+static int32_t __program_request(struct unc_request* req)
+{
+    struct unc_box* box = req->box;
+    int32_t ret;
 
-    /* sbox */
-    if (!__match_box(box, pfm_name, &sbo_regex, sbox, sbox_size, node))
+    if (req->fixed)
+    {
+        req->evt->item = box->fixed[0].ctr;
+        ret = __set_setting(req->evt->fd, box->fixed[0].ctl, req->code | (1u << 22u));
+        if (ret != 8)
+        {
+            fprintf(stderr, "Failed to write counter config for event %s\n", req->name);
+            return -1;
+        }
         return 0;
+    }
 
-    /* no box found */
-    return -1;
+    if (box->filter1_val != 0)
+    {
+        ret = __set_setting(req->evt->fd, box->filter1, box->filter1_val);
+        if (ret != 8)
+        {
+            fprintf(stderr, "Failed to write filter register 1 for event %s\n", req->name);
+            return -1;
+        }
+    }
+    if (box->filter0_val != 0)
+    {
+        ret = __set_setting(req->evt->fd, box->filter0, box->filter0_val);
+        if (ret != 8)
+        {
+            fprintf(stderr, "Failed to write filter register 0 for event %s\n", req->name);
+            return -1;
+        }
+    }
+    req->evt->item = box->norm[req->ctr].ctr;
+    ret = __set_setting(req->evt->fd, box->norm[req->ctr].ctl, req->code | (1u << 22u));
+    if (ret != 8)
+    {
+        fprintf(stderr, "Failed to write counter config for event %s\n", req->name);
+        return -1;
+    }
+    return 0;
 }
 
-int32_t x86a_setup_counter(struct event* evt, pfm_pmu_encode_arg_t* enc, int32_t cpu)
+/* Reprograms the events that __schedule_box() moved to another counter. The new counter starts
+ * at the value of the old one, so the values of the event stay contiguous. All moved counters are
+ * stopped before any is started again, as an event may move to the counter of another. */
+static int32_t __move_requests(int32_t candidate, int32_t* reqs, int32_t reqs_size,
+                               int32_t* old_ctr)
+{
+    uint64_t values[reqs_size];
+
+    for (int32_t r = 0; r < reqs_size; r++)
+    {
+        struct unc_request* req = &(requests[reqs[r]]);
+        if (reqs[r] == candidate || req->ctr == old_ctr[r])
+            continue;
+        if (__get_setting(req->evt->fd, req->box->norm[old_ctr[r]].ctr, &(values[r])) != 8 ||
+            __set_setting(req->evt->fd, req->box->norm[old_ctr[r]].ctl, 0) != 8)
+        {
+            fprintf(stderr, "Failed to stop the counter of event %s\n", req->name);
+            return -1;
+        }
+    }
+    for (int32_t r = 0; r < reqs_size; r++)
+    {
+        struct unc_request* req = &(requests[reqs[r]]);
+        if (reqs[r] == candidate || req->ctr == old_ctr[r])
+            continue;
+        if (__set_setting(req->evt->fd, req->box->norm[req->ctr].ctr, values[r]) != 8)
+        {
+            fprintf(stderr, "Failed to move the counter of event %s\n", req->name);
+            return -1;
+        }
+        if (__program_request(req))
+            return -1;
+    }
+    return 0;
+}
+
+/* check whether the box of an event exists on the node, without reserving a counter */
+int32_t x86a_check_event(const char* fstr, int32_t node)
 {
     struct unc_box* box;
-    int32_t ret, ctr = 0, fixed = 0;
-    uint64_t data;
+    struct unc_box_type* type;
 
-    /* corner case for fixed counters */
-    /* only happens with imc boxes */
-    if (strstr(enc->fstr[0], "unc_imc") != NULL && strstr(enc->fstr[0], "UNC_M_CLOCKTICKS") != NULL)
+    if (__get_box(&box, &type, fstr, node))
     {
-        fixed = 1;
+        fprintf(stderr, "Failed to retrieve box for event %s on node %d\n", fstr, node);
+        return -1;
     }
+    return 0;
+}
 
-    ret = __get_box(&box, (const char*)enc->fstr[0], evt->node);
+int32_t x86a_setup_counter(struct event* evt, pfm_pmu_encode_arg_t* enc, int32_t cpu)
+{
+    struct unc_box* box;
+    struct unc_box_type* type;
+    struct unc_request* req;
+    int32_t ret;
+
+    evt->item = -1;
+
+    ret = __get_box(&box, &type, (const char*)enc->fstr[0], evt->node);
     if (ret)
     {
         fprintf(stderr, "Failed to retrieve box for event %s on node %d\n", enc->fstr[0],
@@ -538,132 +878,222 @@ int32_t x86a_setup_counter(struct event* evt, pfm_pmu_encode_arg_t* enc, int32_t
         return -1;
     }
 
+    if (enc->count < 1 || enc->count > 3)
+    {
+        fprintf(stderr, "Unknown event encode size %d\n", enc->count);
+        return -1;
+    }
+
+    /* counter values are extended to 64 bit while reading */
+    evt->ctr_mask = type->desc->ctr_width < 64 ? (1ull << type->desc->ctr_width) - 1 : ~0ull;
+    evt->last = 0;
+
     /* get fd for the device */
-    evt->fd = x86_adapt_get_device(X86_ADAPT_DIE, evt->node);
+    evt->fd = __get_device(evt->node);
     if (evt->fd < 0)
     {
         fprintf(stderr, "Failed to get file descriptor on cpu %d\n", cpu);
         return -1;
     }
 
-    /* special case, fixed counter */
-    if (fixed)
+    requests = realloc(requests, (requests_size + 1) * sizeof(struct unc_request));
+    check_ptr(requests);
+    req = &(requests[requests_size]);
+    req->evt = evt;
+    req->box = box;
+    req->name = strdup(enc->fstr[0]);
+    req->code = enc->codes[0];
+    req->filter0 = enc->count > 1 ? enc->codes[1] : 0;
+    req->filter1 = enc->count > 2 ? enc->codes[2] : 0;
+    req->ctr_mask = __ctr_mask(type->desc, box, req->code);
+    req->fixed = 0;
+    req->ctr = -1;
+    requests_size++;
+
+    /* corner case for fixed counters */
+    if (type->desc->fixed_event != NULL && box->fixed_size > 0 &&
+        strstr(enc->fstr[0], type->desc->fixed_event) != NULL)
     {
+        if (box->fixed[0].used)
+        {
+            fprintf(stderr, "Fixed counter already in use, can not count event %s\n", req->name);
+            return 0;
+        }
         box->fixed[0].used = 1;
-        evt->item = box->fixed[0].ctr;
-        ret = x86_adapt_set_setting(evt->fd, box->fixed[0].ctl, enc->codes[0] | (1u << 22u));
-        if (ret != 8)
+        req->fixed = 1;
+        req->ctr = 0;
+    }
+    else
+    {
+        int32_t reqs[requests_size];
+        int32_t old_ctr[requests_size];
+        int32_t reqs_size;
+
+        /* events that do not fit are reported by __schedule_box() and not counted */
+        if (!__schedule_box(requests_size - 1, reqs, &reqs_size, old_ctr) && programmed &&
+            __move_requests(requests_size - 1, reqs, reqs_size, old_ctr))
         {
-            fprintf(stderr, "Failed to write counter config for event %s\n", enc->fstr[0]);
             return -1;
         }
-
-        return 0;
     }
 
-    /* normal counter */
-    /* first free counter */
-    while (ctr < box->norm_size && box->norm[ctr].used)
-        ctr++;
-    if (ctr >= box->norm_size)
+    if (programmed && req->ctr >= 0)
     {
-        fprintf(stderr, "No free counter available for event %s\n", enc->fstr[0]);
-        return -1;
+        return __program_request(req);
     }
-    box->norm[ctr].used = 1;
-    evt->item = box->norm[ctr].ctr;
+    return 0;
+}
+
+/* stop counting an event and return its counter to the box */
+int32_t x86a_release_counter(struct event* evt)
+{
+    int32_t ret = 0;
 
-    switch (enc->count)
+    for (int32_t i = 0; i < requests_size; i++)
     {
-    case 3:
-        data = 0;
-        ret = x86_adapt_get_setting(evt->fd, box->filter1, &data);
-        if (!ret)
+        struct unc_request* req = &(requests[i]);
+        struct unc_box* box = req->box;
+        if (req->evt != evt)
         {
-            fprintf(stderr, "Failed to read filter register 1 for event %s\n", enc->fstr[0]);
-            return -1;
+            continue;
         }
-        data |= enc->codes[2];
-        ret = x86_adapt_set_setting(evt->fd, box->filter1, data);
-        if (ret != 8)
+
+        if (req->ctr >= 0 && req->fixed)
         {
-            fprintf(stderr, "Failed to write filter register 1 for event %s\n", enc->fstr[0]);
-            return -1;
+            ret = __check_write(__set_setting(evt->fd, box->fixed[0].ctl, 0), "stop counter");
+            box->fixed[0].used = 0;
         }
-    case 2:
-        data = 0;
-        ret = x86_adapt_get_setting(evt->fd, box->filter0, &data);
-        if (!ret)
+        else if (req->ctr >= 0)
         {
-            fprintf(stderr, "Failed to read filter register 0 for event %s\n", enc->fstr[0]);
-            return -1;
+            ret = __check_write(__set_setting(evt->fd, box->norm[req->ctr].ctl, 0),
+                                "stop counter");
+            box->norm[req->ctr].used = 0;
         }
-        data |= enc->codes[1];
-        ret = x86_adapt_set_setting(evt->fd, box->filter0, data);
-        if (ret != 8)
+        req->ctr = -1;
+        req->evt = NULL;
+
+        /* the filters only have to match the remaining events of the box */
+        box->filter0_val = 0;
+        box->filter1_val = 0;
+        for (int32_t j = 0; j < requests_size; j++)
         {
-            fprintf(stderr, "Failed to write filter register 0 for event %s\n", enc->fstr[0]);
-            return -1;
+            if (requests[j].box == box && requests[j].ctr >= 0)
+            {
+                box->filter0_val |= requests[j].filter0;
+                box->filter1_val |= requests[j].filter1;
+            }
         }
-    case 1:
-        ret = x86_adapt_set_setting(evt->fd, box->norm[ctr].ctl, enc->codes[0] | (1u << 22u));
-        if (ret != 8)
+
+        __put_device(evt->node);
+        evt->item = -1;
+        break;
+    }
+    return ret;
+}
+
+/* write the configuration of all scheduled events, events set up afterwards are programmed
+ * right away */
+int32_t x86a_program_counters(void)
+{
+    int32_t unscheduled = 0;
+
+    for (int32_t i = 0; i < requests_size; i++)
+    {
+        if (requests[i].evt == NULL)
+        {
+            continue;
+        }
+        if (requests[i].ctr < 0)
+        {
+            if (!unscheduled)
+                fprintf(stderr, "The following events could not be scheduled and are not "
+                                "recorded:\n");
+            fprintf(stderr, "  Package %d: %s\n", requests[i].evt->node, requests[i].name);
+            unscheduled++;
+            continue;
+        }
+        if (__program_request(&(requests[i])))
         {
-            fprintf(stderr, "Failed to write counter config for event %s\n", enc->fstr[0]);
             return -1;
         }
-        break;
-    default:
-        fprintf(stderr, "Unknown event encode size %d\n", enc->count);
-        return -1;
     }
+    programmed = 1;
     return 0;
 }
 
-int32_t x86a_unfreeze_all(void)
+/* freeze all boxes of the die behind the given device, used for consistent snapshots */
+int32_t x86a_freeze(int32_t fd, int32_t node)
+{
+    if (arch->freeze == 0)
+    {
+        /* freeze bit of the box control registers */
+        return __write_box_ctl(fd, node, (1u << 8u), __USED_BOXES);
+    }
+    return __check_write(__set_setting(fd, global_ctl, arch->freeze), "freeze counter");
+}
+
+int32_t x86a_unfreeze(int32_t fd, int32_t node)
 {
+    if (arch->freeze == 0)
+    {
+        return __write_box_ctl(fd, node, 0, __USED_BOXES);
+    }
+    return __check_write(__set_setting(fd, global_ctl, arch->unfreeze),
+                         "unfreeze counter");
+}
 
+int32_t x86a_unfreeze_all(void)
+{
     int32_t ret;
     for (int32_t i = 0; i < node_num; i++)
     {
-        int32_t node = x86_adapt_get_device(X86_ADAPT_DIE, i);
+        int32_t node = __get_device(i);
         if (node < 0)
         {
             fprintf(stderr, "Could not get fd for resetting the boxes\n");
-            if (ret == -1)
-            {
-                fprintf(stderr, "Error was: %s(%d)\n", strerror(errno), errno);
-                return errno;
-            }
-            else if (ret < 0)
-            {
-                fprintf(stderr, "Error was: %s(%d)\n", strerror(-ret), ret);
-                return -ret;
-            }
+            return -1;
         }
 
         /* unfreeze counter */
-        ret = x86_adapt_set_setting(node, global_ctl, (1u << 29u));
-        if (ret != 8)
+        ret = x86a_unfreeze(node, i);
+        if (ret)
         {
-            fprintf(stderr, "Failed to unfreeze counter\n");
-            if (ret == -1)
-            {
-                fprintf(stderr, "Error was: %s(%d)\n", strerror(errno), errno);
-                return errno;
-            }
-            else if (ret < 0)
-            {
-                fprintf(stderr, "Error was: %s(%d)\n", strerror(-ret), ret);
-                return -ret;
-            }
-            else
-            {
-                fprintf(stderr, "unexpected nr of bytes written: %d\n", ret);
-                return ret;
-            }
+            return ret;
+        }
+        __put_device(i);
+    }
+    return 0;
+}
+
+/* read the counters of the given events, all events have to be located on the same node */
+int32_t x86a_read_counters(struct event** evts, int32_t size, uint64_t* values)
+{
+#ifdef MSR_DIRECT
+    int32_t regs[size];
+    for (int32_t i = 0; i < size; i++)
+    {
+        regs[i] = evts[i]->item;
+    }
+    if (msr_read_batch(evts[0]->node, regs, size, values))
+    {
+        fprintf(stderr, "Error while reading the counters of node %d\n", evts[0]->node);
+        return -1;
+    }
+#else
+    for (int32_t i = 0; i < size; i++)
+    {
+        if (!__get_setting(evts[i]->fd, evts[i]->item, &(values[i])))
+        {
+            fprintf(stderr, "Error while reading event %s\n", evts[i]->name);
+            values[i] = evts[i]->last;
         }
-        x86_adapt_put_device(X86_ADAPT_DIE, i);
+    }
+#endif
+    /* counter values are extended to 64 bit */
+    for (int32_t i = 0; i < size; i++)
+    {
+        evts[i]->last += (values[i] - evts[i]->last) & evts[i]->ctr_mask;
+        values[i] = evts[i]->last;
     }
     return 0;
 }
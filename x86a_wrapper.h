@@ -27,9 +27,15 @@
 
 #pragma once
 #include <perfmon/pfmlib.h>
+#include <regex.h>
 
 #include "uncore_perf_plugin.h"
 
+/* counter layout of a box */
+#define UNC_CTR_NONE 0
+#define UNC_CTR_SINGLE 1
+#define UNC_CTR_MULTI 2
+
 struct unc_pair
 {
     int32_t used;
@@ -47,35 +53,89 @@ struct unc_box
     int32_t norm_size;
     struct unc_pair* fixed;
     struct unc_pair* norm;
+    uint64_t filter0_val; /* combined filter settings of the scheduled events */
+    uint64_t filter1_val;
+};
+
+/* event restricted to a subset of the counters of a box */
+struct unc_constraint
+{
+    uint64_t event; /* event select code */
+    uint32_t ctr_mask;
+};
+
+/* MSR addresses of a kind of box, used by the msr backend, register offsets are relative to the
+ * address of the box and -1 if the register does not exist */
+struct unc_msr_layout
+{
+    int32_t base;   /* address of the first box */
+    int32_t stride; /* distance between two boxes */
+    int32_t count;  /* maximum number of boxes, boxes that can not be read are skipped */
+    int32_t ctrs;   /* general purpose counters per box */
+    int32_t box_ctl;
+    int32_t status;
+    int32_t filter0;
+    int32_t filter1;
+    int32_t ctl0;
+    int32_t ctr0;
+    int32_t fixed_ctl;
+    int32_t fixed_ctr;
+    const int32_t* offsets; /* addresses of the boxes relative to base, NULL if they are stride
+                               apart */
+};
+
+/* description of one kind of uncore box of a microarchitecture */
+struct unc_box_desc
+{
+    const char* pfm_name;    /* box name used by libpfm, e.g. "unc_cbo", NULL if not in libpfm */
+    const char* prefix;      /* x86_adapt knob prefix, e.g. "C" for C0_PMON_BOX_CTL */
+    int32_t multi;           /* numbered boxes (C0, C1, ...) or a single box */
+    int32_t pfm_offset;      /* libpfm box number of the first box of this kind */
+    int32_t fixed_type;      /* UNC_CTR_* layout of the fixed counters */
+    int32_t norm_type;       /* UNC_CTR_* layout of the general purpose counters */
+    int32_t ctr_width;       /* counter width in bits */
+    const char* fixed_event; /* libpfm event counted by the fixed counter */
+    const char* filter0;     /* knob suffix of the filter registers */
+    const char* filter1;
+    int32_t reset; /* reset the box at initialization */
+    const struct unc_constraint* constraints; /* terminated by an entry with ctr_mask 0 */
+    const struct unc_msr_layout* msr;         /* NULL for PCI or MMIO based boxes */
+};
+
+/* uncore layout of a microarchitecture */
+struct unc_arch_desc
+{
+    const char* name;
+    const int32_t* models; /* CPUID models, terminated by 0 */
+    const char* global_ctl;
+    const char* global_status;
+    const char* global_config;
+    uint64_t freeze;   /* global_ctl value freezing all boxes, 0 to freeze box by box */
+    uint64_t unfreeze; /* global_ctl value unfreezing all boxes */
+    int32_t global_msr; /* MSR address of global_ctl */
+    const struct unc_box_desc* boxes;
+    int32_t boxes_size;
+};
+
+/* boxes of one kind found on this system */
+struct unc_box_type
+{
+    const struct unc_box_desc* desc;
+    struct unc_box* box; /* size boxes per node */
+    int32_t size;
+    regex_t regex;
 };
 
-int32_t global_ctl;
-int32_t global_status;
-int32_t global_config;
-struct unc_box* ubox;
-int32_t ubox_size;
-struct unc_box* pcubox;
-int32_t pcubox_size;
-struct unc_box* cbox;
-int32_t cbox_size;
-struct unc_box* sbox;
-int32_t sbox_size;
-struct unc_box* habox;
-int32_t habox_size;
-struct unc_box* imc0box;
-int32_t imc0box_size;
-struct unc_box* imc1box;
-int32_t imc1box_size;
-struct unc_box* irpbox;
-int32_t irpbox_size;
-struct unc_box* qpibox;
-int32_t qpibox_size;
-struct unc_box* r2pcibox;
-int32_t r2pcibox_size;
-struct unc_box* r3qpibox;
-int32_t r3qpibox_size;
+extern const struct unc_arch_desc unc_archs[];
+extern const int32_t unc_archs_size;
 
 int32_t x86a_wrapper_init(void);
 void x86a_wrapper_fini(void);
+int32_t x86a_check_event(const char* fstr, int32_t node);
 int32_t x86a_setup_counter(struct event*, pfm_pmu_encode_arg_t* enc_evt, int32_t);
+int32_t x86a_release_counter(struct event* evt);
+int32_t x86a_program_counters(void);
 int32_t x86a_unfreeze_all(void);
+int32_t x86a_freeze(int32_t fd, int32_t node);
+int32_t x86a_read_counters(struct event** evts, int32_t size, uint64_t* values);
+int32_t x86a_unfreeze(int32_t fd, int32_t node);